@@ -0,0 +1,483 @@
+#include "sexp.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <math.h>
+
+/* sexp-bench times parsing and printing the objects of corpus files,
+ * such as sexp-gen writes, and prints a line of results for each
+ * corpus and operation, separated by tabs after a line of headings:
+ *	sexp-bench [-L] [-r runs] file ...
+ * Each is done at least runs times, and until the runs have taken
+ * MINSECONDS between them, and the best time kept.  Printing and
+ * hashing are timed apart from the parsing they need; the other
+ * operations are timed whole, as sexp does them with their switches,
+ * printing canonical form.  What is printed goes into memory, so
+ * that writing it out is timed too, as it would not be into /dev/null,
+ * and counts in the peak memory.  The memory is kept from run to run,
+ * so that later runs don't time the system handing out fresh pages.  With -L, lists are read lazily, as
+ * with sexp -L.  Each corpus and operation is done in a process of its
+ * own, so that its peak memory can be told, and its times don't depend
+ * on what was done before it.
+ *
+ * With -s, the files are instead series of corpora of growing sizes,
+ * named corpus-size.sexp, and for each series and operation the driver
+ * fits how the time grows with the size, as size to the power of an
+ * exponent, and fails if the exponent is above limit:
+ *	sexp-bench -s limit [-L] [-r runs] file ...
+ */
+
+/* The operations are parsing, printing in each mode (numbered as the
+ * modes are), hashing, and whole runs with -L, -q, -t, streaming (as
+ * with -c alone), -S then -R, and -j */
+#define PARSE 0
+#define HASH 4
+#define LAZY 5
+#define QUERY 6
+#define TAPES 7
+#define STREAM 8
+#define SNAPSHOT 9
+#define BATCH 10
+#define OPERATIONS 11
+
+static const char *operations[OPERATIONS] = {
+	"parse", "canonical", "base64", "advanced", "hash", "lazy", "query",
+	"tapes", "stream", "snapshot", "batch"
+};
+
+#define QUERYPATH "*/*"		/* what the query operation selects */
+#define BATCHWORKERS 2		/* workers of the batch operation */
+#define MINSECONDS 0.5		/* least time the runs of a measure take */
+#define MAXRUNS 1000
+
+static int lazy = false;	/* whether lists are read lazily (-L) */
+static FILE *output;		/* where what is printed goes */
+static char *outputBytes;
+static size_t outputLength;
+
+/* now()
+ * Returns the time in seconds from some fixed moment.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* printObject(os, object, op)
+ * Prints object with os in mode op, or its hash, on a line of its own.
+ */
+static void
+printObject(sexpOutputStream *os, sexpObject *object, int op)
+{
+	if (op == HASH)
+		hashPrintObject(os, object, SEXP_SHA256);
+	else if (op == CANONICAL) {
+		changeOutputByteSize(os, 8, CANONICAL);
+		canonicalPrintObject(os, object);
+	} else if (op == BASE64)
+		base64PrintWholeObject(os, object);
+	else {
+		changeOutputByteSize(os, 8, ADVANCED);
+		advancedPrintObject(os, object);
+	}
+	os->newLine(os, ADVANCED);
+}
+
+/* printSelection(os, list)
+ * Prints the objects of list in canonical form, each on a line of its
+ * own.
+ */
+static void
+printSelection(sexpOutputStream *os, sexpList *list)
+{
+	sexpIter *iter;
+	sexpObject *object;
+	iter = sexpListIter(list);
+	for (object = sexpIterObject(iter); object != NULL;
+			object = sexpIterObject(iter)) {
+		printObject(os, object, CANONICAL);
+		iter = sexpIterNext(iter);
+	}
+}
+
+/* streamObjects(is, os)
+ * Prints the objects of is in canonical form as they are read, as sexp
+ * does with -c alone.  Returns the number of them.
+ */
+static long int
+streamObjects(sexpInputStream *is, sexpOutputStream *os)
+{
+	sexpEventSink *sink;
+	long int objects = 0;
+	sink = newCanonicalSink(os);
+	is->getChar(is);
+	for (;;) {
+		changeInputByteSize(is, 8);
+		skipWhiteSpace(is);
+		if (is->nextChar == EOF)
+			break;
+		changeOutputByteSize(os, 8, CANONICAL);
+		scanEvents(is, sink);
+		os->newLine(os, ADVANCED);
+		releaseSexpArena(is->arena);
+		objects++;
+	}
+	freeSexpArena(sink->arena);
+	free(sink);
+	return objects;
+}
+
+/* snapshotObjects(is, file)
+ * Writes a snapshot of the objects of is, the input of which is file,
+ * and reads it back, as sexp does with -S and then -R.  Returns the
+ * number of objects.
+ */
+static long int
+snapshotObjects(sexpInputStream *is, char *file)
+{
+	sexpInputStream *snapshot;
+	sexpObject *object;
+	char name[] = "/tmp/sexp-bench-XXXXXX";
+	FILE *f;
+	long int objects = 0;
+	int fd, code;
+	fd = mkstemp(name);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+		err(1, "%s", name);
+	if (writeSnapshot(is, f) != SEXP_OK)
+		errx(1, "%s: %s", file, is->errorMessage);
+	if (fclose(f) != 0)
+		err(1, "%s", name);
+	snapshot = newSexpInputStream();
+	snapshot->snapshot = true;
+	if (!openSexpInputFile(snapshot, name))
+		err(1, "%s", name);
+	unlink(name);
+	while ((code = sexpParseObject(snapshot, &object)) == SEXP_OK) {
+		releaseSexpArena(snapshot->arena);
+		objects++;
+	}
+	if (code != SEXP_EOF)
+		errx(1, "%s: %s", file, snapshot->errorMessage);
+	freeSexpInputStream(snapshot);
+	return objects;
+}
+
+/* countObjects(is)
+ * Returns the number of objects in the mapped input of is, found as
+ * batch mode finds them, without parsing them.
+ */
+static long int
+countObjects(sexpInputStream *is)
+{
+	size_t start = 0, end = 0;
+	long int objectEnd, objects = 0;
+	while ((objectEnd = findObjectEnd(is->buffer, is->bufferLength, end,
+			&start)) >= 0) {
+		objects++;
+		end = objectEnd;
+	}
+	/* only a token can end with the input */
+	return objects + (start < is->bufferLength);
+}
+
+/* batchObjects(is, os)
+ * Prints the objects of is in canonical form with a pool of workers,
+ * as sexp does with -j.
+ */
+static void
+batchObjects(sexpInputStream *is, sexpOutputStream *os)
+{
+	sexpBatch *b;
+	b = newSexpBatch(BATCHWORKERS);
+	b->canonical = true;
+	b->lazy = is->lazy;
+	batchProcess(b, is, os, BATCHWORKERS);
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->queuedJob);
+	pthread_cond_destroy(&b->doneJob);
+	free(b->jobs);
+	free(b);
+}
+
+/* runOperation(file, op, objects)
+ * Does op on all the objects of file once, counting them in *objects.
+ * Returns the time it took.
+ */
+static double
+runOperation(char *file, int op, long int *objects)
+{
+	sexpInputStream *is;
+	sexpOutputStream *os;
+	sexpObject *object;
+	double start, seconds = 0;
+	int code;
+	is = newSexpInputStream();
+	if (!openSexpInputFile(is, file))
+		err(1, "%s", file);
+	is->lazy = lazy || op == LAZY || op == QUERY;
+	is->tapes = op == TAPES;
+	os = newSexpOutputStream();
+	if (output == NULL
+		&& (output = open_memstream(&outputBytes, &outputLength)) == NULL)
+		err(1, "%s", "open_memstream");
+	rewind(output);
+	os->outputFile = output;
+	*objects = 0;
+	if (op == BATCH)
+		*objects = countObjects(is);
+	start = now();
+	if (op == STREAM)
+		*objects = streamObjects(is, os);
+	else if (op == SNAPSHOT)
+		*objects = snapshotObjects(is, file);
+	else if (op == BATCH)
+		batchObjects(is, os);
+	while (op < STREAM && (code = sexpParseObject(is, &object)) == SEXP_OK) {
+		if (op == QUERY)
+			printSelection(os, sexpQuery(is->arena, object, QUERYPATH));
+		else if (op == LAZY || op == TAPES)
+			printObject(os, object, CANONICAL);
+		else if (op != PARSE) {
+			start = now();
+			printObject(os, object, op);
+			seconds += now() - start;
+		}
+		releaseSexpArena(is->arena);
+		++*objects;
+	}
+	if (op == PARSE || op > HASH) {
+		fflush(os->outputFile);
+		seconds = now() - start;
+	}
+	if (op < STREAM && code != SEXP_EOF)
+		errx(1, "%s: %s", file, is->errorMessage);
+	free(os->layout);
+	free(os->stack);
+	free(os);
+	freeSexpInputStream(is);
+	return seconds;
+}
+
+/* operationDone(op)
+ * Returns whether op is done at all: with -L, those that always read
+ * lazily, or read no lists, would only be done again as they are.
+ */
+static int
+operationDone(int op)
+{
+	return !lazy || (op != LAZY && op != QUERY && op != STREAM);
+}
+
+/* operationName(op)
+ * Returns the name of op, as it is done.
+ */
+static const char *
+operationName(int op)
+{
+	static char name[32];
+	if (!lazy)
+		return operations[op];
+	sprintf(name, "lazy-%s", operations[op]);
+	return name;
+}
+
+/* corpusName(file, length)
+ * Returns the name of the corpus in file, with its length in *length:
+ * the name of the file, less its directory and extension.
+ */
+static char *
+corpusName(char *file, int *length)
+{
+	char *name, *dot;
+	name = strrchr(file, '/');
+	name = name == NULL ? file : name + 1;
+	dot = strrchr(name, '.');
+	*length = dot == NULL ? (int) strlen(name) : (int) (dot - name);
+	return name;
+}
+
+/* seriesLength(file)
+ * Returns the length of the name of the series of corpora file is in,
+ * which is the name of its corpus, less any size after the last '-'.
+ */
+static int
+seriesLength(char *file)
+{
+	char *name;
+	int length, i;
+	name = corpusName(file, &length);
+	for (i = length; i > 0; i--)
+		if (name[i - 1] == '-')
+			return i - 1;
+	return length;
+}
+
+/* sameSeries(file, other)
+ * Returns whether the corpora in file and other are of the same series.
+ */
+static int
+sameSeries(char *file, char *other)
+{
+	int n = seriesLength(file), length;
+	return seriesLength(other) == n
+		&& strncmp(corpusName(file, &length), corpusName(other, &length), n) == 0;
+}
+
+/* bestTime(file, op, runs, objects)
+ * Does op on the objects of file at least runs times, and more until
+ * the runs have taken MINSECONDS, counting them in *objects.  Returns
+ * the best time.  A single run of a small corpus is at the mercy of
+ * the scheduler and the caches, which the best of many is not.
+ */
+static double
+bestTime(char *file, int op, int runs, long int *objects)
+{
+	double seconds, total = 0, best = -1;
+	int i;
+	for (i = 0; i < MAXRUNS && (i < runs || total < MINSECONDS); i++) {
+		seconds = runOperation(file, op, objects);
+		total += seconds;
+		if (best < 0 || seconds < best)
+			best = seconds;
+	}
+	return best <= 0 ? 1e-9 : best;
+}
+
+/* measure(file, op, runs)
+ * Does op on the objects of file runs times, and prints a line of its
+ * results, with the best time.
+ */
+static void
+measure(char *file, int op, int runs)
+{
+	struct stat st;
+	struct rusage usage;
+	char *name;
+	double best;
+	long int objects = 0;
+	int length;
+	if (stat(file, &st) != 0)
+		err(1, "%s", file);
+	best = bestTime(file, op, runs, &objects);
+	getrusage(RUSAGE_SELF, &usage);
+	name = corpusName(file, &length);
+	printf("%.*s\t%s\t%ld\t%ld\t%.6f\t%.2f\t%.0f\t%ld\n", length, name,
+		operationName(op), (long int) st.st_size, objects, best,
+		st.st_size / best / 1e6, objects / best, usage.ru_maxrss);
+}
+
+/* scale(files, n, op, runs, limit)
+ * Does op on each of the n corpora of a series in files, fits the
+ * exponent of the growth of the best time with the size by least
+ * squares over their logarithms, and prints a line of the result.
+ * Returns whether the exponent is within limit.
+ */
+static int
+scale(char **files, int n, int op, int runs, double limit)
+{
+	struct stat st;
+	double x, y, sx = 0, sy = 0, sxx = 0, sxy = 0, exponent;
+	long int objects, smallest = 0, largest = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (stat(files[i], &st) != 0)
+			err(1, "%s", files[i]);
+		if (i == 0 || st.st_size < smallest)
+			smallest = st.st_size;
+		if (st.st_size > largest)
+			largest = st.st_size;
+		x = log((double) st.st_size);
+		y = log(bestTime(files[i], op, runs, &objects));
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	if (n * sxx - sx * sx < 1e-6)
+		errx(1, "%s: a series needs corpora of different sizes", files[0]);
+	exponent = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	printf("%.*s\t%s\t%d\t%ld\t%ld\t%.2f\t%.2f\t%s\n",
+		seriesLength(files[0]), corpusName(files[0], &i), operationName(op), n,
+		smallest, largest, exponent, limit, exponent <= limit ? "ok" : "FAIL");
+	fflush(stdout);
+	return exponent <= limit;
+}
+
+/* runApart(files, n, op, runs, limit)
+ * Measures op on the first of files, or with a limit scales it over
+ * the n of them, in a process of its own, so that neither its peak
+ * memory nor its times depend on what was done before it.  Returns
+ * whether the exponent was within limit.
+ */
+static int
+runApart(char **files, int n, int op, int runs, double limit)
+{
+	pid_t pid;
+	int status;
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		err(1, "%s", "fork");
+	if (pid == 0) {
+		if (limit > 0 && !scale(files, n, op, runs, limit)) {
+			fflush(stdout);
+			_exit(2);
+		}
+		if (limit == 0)
+			measure(files[0], op, runs);
+		fflush(stdout);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+		|| (WEXITSTATUS(status) != 0 && WEXITSTATUS(status) != 2))
+		errx(1, "%s %s failed", files[0], operationName(op));
+	return WEXITSTATUS(status) == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int i = 1, j, op, runs = 3, ok = true;
+	double limit = 0;
+	for (; i < argc && argv[i][0] == '-'; i++)
+		if (strcmp(argv[i], "-L") == 0)
+			lazy = true;
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			limit = atof(argv[++i]);
+		else
+			break;
+	if (i >= argc || argv[i][0] == '-' || runs < 1 || limit < 0) {
+		fprintf(stderr,
+			"usage: sexp-bench [-s limit] [-L] [-r runs] file ...\n");
+		return 1;
+	}
+	initializeCharacterTables();
+	initializeMemory();
+	if (limit > 0) {
+		printf("corpus\toperation\tsizes\tsmallest\tlargest\texponent"
+			"\tlimit\tresult\n");
+		/* a series is the files in a row with the same name before sizes */
+		for (; i < argc; i = j) {
+			for (j = i + 1; j < argc && sameSeries(argv[i], argv[j]); j++)
+				;
+			for (op = PARSE; op < OPERATIONS; op++)
+				if (operationDone(op)
+					&& !runApart(argv + i, j - i, op, runs, limit))
+					ok = false;
+		}
+		return ok ? 0 : 1;
+	}
+	printf("corpus\toperation\tbytes\tobjects\tseconds\tMB/s\tobjects/s"
+		"\tmaxrss_kB\n");
+	for (; i < argc; i++)
+		for (op = PARSE; op < OPERATIONS; op++)
+			if (operationDone(op))
+				runApart(argv + i, 1, op, runs, 0);
+	return 0;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* sexp-gen writes a corpus of S-expressions of one shape, of about a
+ * given number of bytes, for the benchmarks.  The same arguments always
+ * give the same corpus.
+ *	sexp-gen corpus bytes [seed]
+ */
+
+/* Words the corpora are made of, as in SPKI certificates */
+static const char *words[] = {
+	"cert", "issuer", "subject", "public-key", "rsa-pkcs1-md5", "e", "n",
+	"hash", "md5", "sha1", "tag", "valid", "not-before", "not-after",
+	"propagate", "name", "ftp", "http", "read", "write", "*", "set",
+	"prefix", "range", "alpha", "numeric", "signature", "sequence",
+	"do", "hide", "online", "crl"
+};
+#define WORDS (sizeof words / sizeof words[0])
+
+static uint32_t state = 1;
+static long int written = 0;
+
+/* randomNumber(n)
+ * Returns the next pseudo-random number from 0 to n - 1 (xorshift).
+ */
+static uint32_t
+randomNumber(uint32_t n)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state % n;
+}
+
+/* putBytes(bytes, n)
+ * Writes the n bytes at bytes to the corpus.
+ */
+static void
+putBytes(const void *bytes, size_t n)
+{
+	if (fwrite(bytes, 1, n, stdout) != n) {
+		perror("sexp-gen");
+		exit(1);
+	}
+	written += n;
+}
+
+/* putString(s)
+ * Writes the characters of s to the corpus.
+ */
+static void
+putString(const char *s)
+{
+	putBytes(s, strlen(s));
+}
+
+/* putWord()
+ * Writes a word, as a token.
+ */
+static void
+putWord(void)
+{
+	putString(words[randomNumber(WORDS)]);
+}
+
+/* putVerbatim(s, n)
+ * Writes the n bytes at s as a verbatim string.
+ */
+static void
+putVerbatim(const char *s, size_t n)
+{
+	char length[24];
+	sprintf(length, "%lu:", (unsigned long int) n);
+	putString(length);
+	putBytes(s, n);
+}
+
+/* wideObject()
+ * A flat list of a thousand items.
+ */
+static void
+wideObject(void)
+{
+	int i;
+	putString("(row");
+	for (i = 0; i < 1000; i++) {
+		putString(" ");
+		putWord();
+	}
+	putString(")\n");
+}
+
+/* deepObject()
+ * Lists nested a thousand deep, each with a word before the next.
+ */
+static void
+deepObject(void)
+{
+	int i;
+	for (i = 0; i < 1000; i++) {
+		putString("(");
+		putWord();
+		putString(" ");
+	}
+	putString("leaf");
+	for (i = 0; i < 1000; i++)
+		putString(")");
+	putString("\n");
+}
+
+/* blobObject()
+ * A canonical list holding a binary string of up to 64K bytes.
+ */
+static void
+blobObject(void)
+{
+	static char data[65536];
+	char id[9];
+	size_t i, n = 256 + randomNumber(sizeof data - 256);
+	for (i = 0; i < n; i++)
+		data[i] = (char) randomNumber(256);
+	sprintf(id, "%08lx", (unsigned long int) randomNumber(0xFFFFFFFFU));
+	putString("(4:blob(2:id");
+	putVerbatim(id, 8);
+	putString(")(4:data");
+	putVerbatim(data, n);
+	putString("))");
+}
+
+/* tokenObject()
+ * A certificate in advanced form, made mostly of tokens.
+ */
+static void
+tokenObject(void)
+{
+	int i, n = 4 + randomNumber(12);
+	putString("(cert\n (issuer (name ");
+	putWord();
+	putString("))\n (subject (public-key (rsa-pkcs1-md5 (e ");
+	putWord();
+	putString(") (n ");
+	putWord();
+	putString("))))\n (tag (*");
+	for (i = 0; i < n; i++) {
+		putString(" (");
+		putWord();
+		putString(" ");
+		putWord();
+		putString(")");
+	}
+	putString("))\n (valid (not-before \"1997-01-01_00:00:00\")"
+		" (not-after \"2027-01-01_00:00:00\"))\n (propagate))\n");
+}
+
+/* base64Object()
+ * A certificate in canonical form, in a {...} transport region.
+ */
+static void
+base64Object(void)
+{
+	static const char digits[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char canonical[1024], encoded[1400], *s = canonical, *e = encoded;
+	const char *w;
+	size_t i, n;
+	int j, m = 4 + randomNumber(12);
+	uint32_t bits;
+	s += sprintf(s, "(4:cert(6:issuer(4:name");
+	w = words[randomNumber(WORDS)];
+	s += sprintf(s, "%lu:%s))(3:tag(1:*", (unsigned long int) strlen(w), w);
+	for (j = 0; j < m; j++) {
+		w = words[randomNumber(WORDS)];
+		s += sprintf(s, "%lu:%s", (unsigned long int) strlen(w), w);
+	}
+	s += sprintf(s, "))(9:propagate))");
+	n = s - canonical;
+	for (i = 0; i < n; i += 3) {
+		bits = (uint32_t) (uint8_t) canonical[i] << 16;
+		if (i + 1 < n)
+			bits |= (uint32_t) (uint8_t) canonical[i + 1] << 8;
+		if (i + 2 < n)
+			bits |= (uint8_t) canonical[i + 2];
+		*e++ = digits[bits >> 18 & 63];
+		*e++ = digits[bits >> 12 & 63];
+		*e++ = i + 1 < n ? digits[bits >> 6 & 63] : '=';
+		*e++ = i + 2 < n ? digits[bits & 63] : '=';
+	}
+	putString("{");
+	putBytes(encoded, e - encoded);
+	putString("}\n");
+}
+
+/* quotedObject()
+ * A list of quoted strings full of escapes.
+ */
+static void
+quotedObject(void)
+{
+	static const char *pieces[] = {
+		"plain text ", "\\n", "\\t", "\\\"quoted\\\"", "\\\\", "\\x41",
+		"\\101", "\\r", "it\\'s ", "\\\n", "more words "
+	};
+	int i, j, n;
+	putString("(q");
+	for (i = 0; i < 8; i++) {
+		putString(" \"");
+		n = 2 + randomNumber(20);
+		for (j = 0; j < n; j++)
+			putString(pieces[randomNumber(sizeof pieces / sizeof pieces[0])]);
+		putString("\"");
+	}
+	putString(")\n");
+}
+
+/* The corpora for telling how the time taken grows are each one object
+ * of the size asked for, or, along count, many small ones. */
+
+/* widthCorpus(bytes)
+ * A single flat list.
+ */
+static void
+widthCorpus(long int bytes)
+{
+	putString("(row");
+	while (written < bytes - 1) {
+		putString(" ");
+		putWord();
+	}
+	putString(")\n");
+}
+
+/* depthCorpus(bytes)
+ * A single list, of lists nested as deep as it takes.
+ */
+static void
+depthCorpus(long int bytes)
+{
+	long int i, n = bytes / 4;
+	for (i = 0; i < n; i++)
+		putString("(d ");
+	putString("x");
+	for (i = 0; i < n; i++)
+		putString(")");
+	putString("\n");
+}
+
+/* lengthCorpus(bytes)
+ * A list of a single quoted string, with escapes.
+ */
+static void
+lengthCorpus(long int bytes)
+{
+	putString("(s \"");
+	while (written < bytes - 3)
+		putString(randomNumber(4) == 0 ? "\\t" : "text ");
+	putString("\")\n");
+}
+
+/* countCorpus(bytes)
+ * Small objects, as many as it takes.
+ */
+static void
+countCorpus(long int bytes)
+{
+	while (written < bytes) {
+		putString("(item ");
+		putWord();
+		putString(")\n");
+	}
+}
+
+/* The shapes of corpora, by name */
+static const struct {
+	const char *name;
+	void (*object)(void);		/* writes an object of the shape */
+	void (*corpus)(long int);	/* writes the whole corpus, instead */
+} corpora[] = {
+	{ "wide", wideObject, NULL },
+	{ "deep", deepObject, NULL },
+	{ "blob", blobObject, NULL },
+	{ "token", tokenObject, NULL },
+	{ "base64", base64Object, NULL },
+	{ "quoted", quotedObject, NULL },
+	{ "width", NULL, widthCorpus },
+	{ "depth", NULL, depthCorpus },
+	{ "length", NULL, lengthCorpus },
+	{ "count", NULL, countCorpus }
+};
+#define CORPORA (sizeof corpora / sizeof corpora[0])
+
+int
+main(int argc, char **argv)
+{
+	size_t i;
+	long int bytes;
+	if (argc < 3 || argc > 4 || (bytes = atol(argv[2])) <= 0) {
+		fprintf(stderr, "usage: sexp-gen corpus bytes [seed]\n");
+		return 1;
+	}
+	if (argc == 4)
+		state = strtoul(argv[3], NULL, 10) | 1;
+	for (i = 0; i < CORPORA; i++)
+		if (strcmp(argv[1], corpora[i].name) == 0)
+			break;
+	if (i == CORPORA) {
+		fprintf(stderr, "sexp-gen: unknown corpus %s\n", argv[1]);
+		return 1;
+	}
+	if (corpora[i].corpus != NULL)
+		corpora[i].corpus(bytes);
+	while (written < bytes)
+		corpora[i].object();
+	return fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include "sexp.h"
+
+/* sexp-check runs checks of the library that the sexp program can't
+ * make from its command line, and prints a line for each that fails:
+ *	sexp-check
+ * It exits with status 1 if any did.
+ */
+
+static int failed = 0;
+
+/* check(ok, what)
+ * Counts check what as failed, and says so, unless ok.
+ */
+static void
+check(int ok, const char *what)
+{
+	if (ok)
+		return;
+	printf("FAIL\t%s\n", what);
+	failed++;
+}
+
+/* parseText(is, text)
+ * Returns the object in text, parsed by memory input stream is in
+ * place of what it read before.
+ */
+static sexpObject *
+parseText(sexpInputStream *is, const char *text)
+{
+	sexpObject *object;
+	resetSexpMemoryInputStream(is, (uint8_t *) text, strlen(text));
+	if (sexpParseObject(is, &object) != SEXP_OK)
+		errx(1, "%s", is->errorMessage);
+	return object;
+}
+
+/* listItem(object, i)
+ * Returns item i, from 0, of list object.
+ */
+static sexpObject *
+listItem(sexpObject *object, int i)
+{
+	sexpIter *iter = sexpListIter((sexpList *) object);
+	for (; i > 0; i--)
+		iter = sexpIterNext(iter);
+	return sexpIterObject(iter);
+}
+
+/* hasDigest(os, object, a, hex)
+ * Returns whether the SHA-256 digest of the canonical form of object,
+ * as sexpObjectDigest() gives it with caches in arena a, is hex.
+ */
+static int
+hasDigest(sexpOutputStream *os, sexpObject *object, sexpArena *a,
+	const char *hex)
+{
+	uint8_t *digest = sexpObjectDigest(os, object, SEXP_SHA256, a);
+	char s[3];
+	int i;
+	for (i = 0; i < digestLength(SEXP_SHA256); i++) {
+		sprintf(s, "%02x", digest[i]);
+		if (memcmp(s, hex + 2 * i, 2) != 0)
+			return false;
+	}
+	return true;
+}
+
+/* checkHashCaches(is, os)
+ * Checks that changing a string of an object hashed before, whether
+ * for the lengths only or for the Merkle digests too, puts the change
+ * into the length and digest of the object.
+ */
+static void
+checkHashCaches(sexpInputStream *is, sexpOutputStream *os)
+{
+	static const char *before = "(1:a(1:b1:c)1:d)";
+	static const char *after = "(1:a(1:b2:zz)1:d)";
+	sexpArena *a = is->arena;
+	sexpObject *object, *c;
+	sexpSimpleString *ss;
+	int algorithm;
+	for (algorithm = 0; algorithm <= SEXP_SHA256; algorithm += SEXP_SHA256) {
+		object = parseText(is, "(a (b c) d)");
+		c = listItem(listItem(object, 1), 1);
+		check(sexpHashTree(object, algorithm, a)->length
+			== (long int) strlen(before), "hash cache length");
+		check(hasDigest(os, object, a, "c5748747f25a04e49c849db086933006"
+			"f4f73fef0a7e8f226a76e76e5f1f43fa"), "hash cache digest");
+		ss = newSimpleString(a);
+		appendBytesToSimpleString((uint8_t *) "zz", 2, ss);
+		setSexpStringString((sexpString *) c, ss);
+		check(sexpHashTree(object, algorithm, a)->length
+			== (long int) strlen(after), "hash cache length after a change");
+		check(hasDigest(os, object, a, "98c36bf9910b673e51bac9f17493d21c"
+			"0ad471b34e3191f7906b03e7c40ee442"),
+			"hash cache digest after a change");
+	}
+}
+
+int
+main(void)
+{
+	sexpInputStream *is;
+	sexpOutputStream *os;
+	initializeCharacterTables();
+	initializeMemory();
+	is = newSexpMemoryInputStream((uint8_t *) "", 0);
+	os = newSexpOutputStream();
+	checkHashCaches(is, os);
+	freeSexpInputStream(is);
+	return failed > 0;
+}
@@ -7,5 +7,5 @@ MANSECTION = 1
 CC = cc
 CFLAGS = -std=c89 -Wall -Wextra -pedantic -O2 \
 	$(shell pkg-config --cflags libbsd-overlay) # GNU extension
-CPPFLAGS = 
-LDFLAGS = -s $(shell pkg-config --libs libbsd-overlay)
+CPPFLAGS = -D_POSIX_C_SOURCE=200809L
+LDFLAGS = -s -lpthread $(shell pkg-config --libs libbsd-overlay)
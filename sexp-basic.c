@@ -4,24 +4,214 @@
  * Take care of memory initialization 
  */
 void
-initializeMemory() {} /* nothing in this implementation -- use malloc */
+initializeMemory() {} /* nothing to do -- each input stream has its arena */
+
+/**********/
+/* ARENAS */
+/**********/
+
+/* Objects read from an input stream are carved out of large blocks
+ * owned by an arena, so that a whole parsed tree can be given back with
+ * a single call to releaseSexpArena().  Requests too big to share a
+ * block get a block of their own.  A null arena means plain malloc.
+ */
+
+#define ARENABLOCKSIZE 65536L
+#define ARENAALIGN sizeof (union { long int l; double d; void *p; })
+
+/* outOfMemory(a, what)
+ * Reports that there is no memory for what, needed along with storage
+ * from arena a: to the arena's error handler, if it has one.
+ */
+void
+outOfMemory(sexpArena *a, char *what)
+{
+	if (a != NULL && a->onError != NULL)
+		longjmp(*a->onError, SEXP_ERR_MEMORY);
+	err(1, "Can't allocate %s", what);
+}
+
+/* newArenaBlock(a, size)
+ * Allocates a block for arena a with room for size bytes after its
+ * header.
+ */
+static sexpArenaBlock *
+newArenaBlock(sexpArena *a, size_t size)
+{
+	sexpArenaBlock *b;
+	int phase = SEXP_ENTER(a->stats, SEXP_PHASE_ALLOCATE);
+	b = malloc(sizeof (sexpArenaBlock) + size);
+	SEXP_LEAVE(a->stats, phase);
+	if (b == NULL)
+		outOfMemory(a, "arena block");
+	SEXP_COUNT(a->stats, blocks, 1);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+/* arenaBlockData(b)
+ * Returns the first usable byte of block b.
+ */
+static uint8_t *
+arenaBlockData(sexpArenaBlock *b)
+{
+	return (uint8_t *) (b + 1);
+}
+
+/* newSexpArena()
+ * Creates a new, empty arena.
+ */
+sexpArena *
+newSexpArena()
+{
+	sexpArena *a;
+	a = malloc(sizeof (sexpArena));
+	if (a == NULL)
+		outOfMemory(NULL, "arena");
+	a->onError = NULL;
+	a->stats = NULL;
+	a->blocks = newArenaBlock(a, ARENABLOCKSIZE);
+	a->lastBlock = NULL;
+	a->last = NULL;
+	return a;
+}
+
+/* arenaAllocate(a, size)
+ * Returns size bytes of storage from arena a.
+ */
+void *
+arenaAllocate(sexpArena *a, size_t size)
+{
+	sexpArenaBlock *b;
+	if (a == NULL)
+		return malloc(size);
+	size = (size + ARENAALIGN - 1) & ~(ARENAALIGN - 1);
+	SEXP_COUNT(a->stats, allocations, 1);
+	SEXP_COUNT(a->stats, allocatedBytes, size);
+	b = a->blocks;
+	if (b->size - b->used < size) {
+		if (size > ARENABLOCKSIZE / 4) {
+			/* give it a block of its own, behind the current one */
+			b = newArenaBlock(a, size);
+			b->next = a->blocks->next;
+			a->blocks->next = b;
+		} else {
+			b = newArenaBlock(a, ARENABLOCKSIZE);
+			b->next = a->blocks;
+			a->blocks = b;
+		}
+	}
+	a->last = arenaBlockData(b) + b->used;
+	a->lastBlock = b;
+	b->used += size;
+	return a->last;
+}
+
+/* arenaReallocate(a, p, oldsize, newsize)
+ * Grows the storage at p, obtained from arena a, to newsize bytes and
+ * returns its new location.  The most recent allocation is grown in
+ * place when its block has room; storage that has to move is zeroed,
+ * as it may be sensitive.
+ */
+void *
+arenaReallocate(sexpArena *a, void *p, size_t oldsize, size_t newsize)
+{
+	sexpArenaBlock *b, *nb, **link;
+	uint8_t *q;
+	if (a == NULL || p == NULL || p != a->last)
+		goto move;
+	b = a->lastBlock;
+	newsize = (newsize + ARENAALIGN - 1) & ~(ARENAALIGN - 1);
+	oldsize = arenaBlockData(b) + b->used - (uint8_t *) p;
+	if (b->size - b->used >= newsize - oldsize) {
+		b->used += newsize - oldsize;
+		return p;
+	}
+	if (b != a->blocks && arenaBlockData(b) == p) {
+		/* p has a block of its own: replace the block */
+		nb = newArenaBlock(a, newsize);
+		memcpy(arenaBlockData(nb), p, oldsize);
+		nb->used = newsize;
+		for (link = &a->blocks->next; *link != b; link = &(*link)->next)
+			;
+		nb->next = b->next;
+		*link = nb;
+		memset(b, 0, sizeof (sexpArenaBlock) + b->size);
+		free(b);
+		a->last = arenaBlockData(nb);
+		a->lastBlock = nb;
+		return a->last;
+	}
+  move:
+	if (a == NULL) {
+		q = malloc(newsize);
+		if (p != NULL) {
+			memcpy(q, p, oldsize);
+			memset(p, 0, oldsize);
+			free(p);
+		}
+		return q;
+	}
+	q = arenaAllocate(a, newsize);
+	if (p != NULL) {
+		memcpy(q, p, oldsize);
+		memset(p, 0, oldsize);
+	}
+	return q;
+}
+
+/* releaseSexpArena(a)
+ * Gives back everything allocated from arena a, so that all objects
+ * built from it become invalid at once.  The storage is zeroed first,
+ * as it may be sensitive.  One block is kept for reuse.
+ */
+void
+releaseSexpArena(sexpArena *a)
+{
+	sexpArenaBlock *b, *next;
+	b = a->blocks;
+	while (b->next != NULL) {
+		next = b->next;
+		b->next = next->next;
+		memset(next, 0, sizeof (sexpArenaBlock) + next->size);
+		free(next);
+	}
+	memset(arenaBlockData(b), 0, b->used);
+	b->used = 0;
+	a->last = NULL;
+	a->lastBlock = NULL;
+}
+
+/* freeSexpArena(a)
+ * Releases arena a and frees the arena itself.
+ */
+void
+freeSexpArena(sexpArena *a)
+{
+	releaseSexpArena(a);
+	free(a->blocks);
+	free(a);
+}
 
 /***********************************/
 /* SEXP SIMPLE STRING MANIPULATION */
 /***********************************/
 
-/* newSimpleString()
- * Creates and initializes new sexpSimpleString object.
+/* newSimpleString(a)
+ * Creates and initializes new sexpSimpleString object in arena a.
  * Allocates 16-character buffer to hold string.
  */
 sexpSimpleString *
-newSimpleString()
+newSimpleString(sexpArena *a)
 {
 	sexpSimpleString *ss;
-	ss = malloc(sizeof (sexpSimpleString));
+	ss = arenaAllocate(a, sizeof (sexpSimpleString));
 	ss->length = 0;
 	ss->allocatedLength = 16;
-	ss->string = malloc(16);
+	ss->arena = a;
+	ss->string = arenaAllocate(a, 16);
 	return ss;
 }
 
@@ -31,6 +221,8 @@ newSimpleString()
 long int
 simpleStringLength(sexpSimpleString *ss)
 {
+	if (ss->length < 0)
+		return -1 - ss->length;	/* a sexpTapeString */
 	return ss->length;
 }
 
@@ -40,9 +232,43 @@ simpleStringLength(sexpSimpleString *ss)
 uint8_t *
 simpleStringString(sexpSimpleString *ss)
 {
+	if (ss->length < 0)
+		return (uint8_t *) ss + ((sexpTapeString *) ss)->offset;
 	return ss->string;
 }
 
+/* borrowSimpleString(ss, bytes, n)
+ * Makes ss refer to the n bytes at bytes without copying them.
+ * The bytes must stay put for as long as ss is used; ss makes a
+ * private copy before it is changed.
+ */
+void
+borrowSimpleString(sexpSimpleString *ss, uint8_t *bytes, long int n)
+{
+	ss->string = bytes;
+	ss->length = n;
+	ss->allocatedLength = -1;
+}
+
+/* resizeSimpleString(ss, newsize)
+ * Moves ss to storage of newsize bytes.
+ * Storage owned by ss is zeroed when it moves, as it may be sensitive;
+ * borrowed storage is just copied.
+ */
+static void
+resizeSimpleString(sexpSimpleString *ss, size_t newsize)
+{
+	uint8_t *newstring;
+	if (ss->allocatedLength < 0) {
+		newstring = arenaAllocate(ss->arena, newsize);
+		memcpy(newstring, ss->string, ss->length);
+		ss->string = newstring;
+	} else
+		ss->string = arenaReallocate(ss->arena, ss->string,
+			ss->allocatedLength, newsize);
+	ss->allocatedLength = newsize;
+}
+
 /* reallocateSimpleString(ss)
  * Changes space allocated to ss.
  * Space allocated is set to roughly 3/2 the current string length, plus 16.
@@ -50,22 +276,12 @@ simpleStringString(sexpSimpleString *ss)
 sexpSimpleString *
 reallocateSimpleString(sexpSimpleString *ss)
 {
-	size_t newsize;
-	uint8_t *newstring;
 	if (ss == NULL)
-		ss = newSimpleString();
+		ss = newSimpleString(NULL);
 	if (ss->string == NULL)
-		ss->string = malloc(16);
-	else {
-		newsize = 16 + 3 * (ss->length) / 2;
-		newstring = malloc(newsize);
-		memcpy(newstring, ss->string, ss->allocatedLength);
-		/* Zero string before freeing, as it may be sensitive */
-		memset(ss->string, 0, ss->allocatedLength);
-		free(ss->string);
-		ss->string = newstring;
-		ss->allocatedLength = newsize;
-	}
+		ss->string = arenaAllocate(ss->arena, 16);
+	else
+		resizeSimpleString(ss, 16 + 3 * (ss->length) / 2);
 	return ss;
 }
 
@@ -77,29 +293,158 @@ void
 appendCharToSimpleString(int c, sexpSimpleString *ss)
 {
 	if (ss == NULL)
-		ss = newSimpleString();
-	if (ss->string == NULL || ss->length == ss->allocatedLength)
+		ss = newSimpleString(NULL);
+	if (ss->string == NULL || ss->length >= ss->allocatedLength)
 		ss = reallocateSimpleString(ss);
 	ss->string[ss->length] = (uint8_t) (c & 0xFF);
 	ss->length++;
 }
 
+/* appendBytesToSimpleString(bytes, n, ss)
+ * Appends the n bytes at bytes to the end of simple string ss,
+ * growing its storage at most once.
+ */
+void
+appendBytesToSimpleString(uint8_t *bytes, long int n, sexpSimpleString *ss)
+{
+	size_t newsize;
+	if (ss->string == NULL || ss->length + n > ss->allocatedLength) {
+		newsize = 16 + 3 * (ss->length) / 2;
+		if (newsize < (size_t) (ss->length + n))
+			newsize = ss->length + n;
+		if (ss->string == NULL)
+			ss->allocatedLength = 0;
+		resizeSimpleString(ss, newsize);
+	}
+	memcpy(ss->string + ss->length, bytes, n);
+	ss->length += n;
+}
+
+/*********/
+/* ATOMS */
+/*********/
+
+/* The same short tokens and hints come up again and again in real
+ * data.  An atom table keeps one copy of each, so that reading one
+ * again costs no storage, and two atoms of one table are the same
+ * string just when their pointers are equal.  Atoms are borrowed
+ * strings in the table's own arena, and must not be changed.  Once the
+ * table holds MAXATOMS of them, new strings are left out of it.
+ */
+
+/* newSexpAtomTable()
+ * Creates a new, empty atom table.
+ */
+sexpAtomTable *
+newSexpAtomTable()
+{
+	sexpAtomTable *t;
+	t = malloc(sizeof (sexpAtomTable));
+	if (t == NULL)
+		outOfMemory(NULL, "atom table");
+	t->arena = newSexpArena();
+	t->size = 1024;
+	t->count = 0;
+	t->slots = calloc(t->size, sizeof (sexpSimpleString *));
+	if (t->slots == NULL)
+		outOfMemory(NULL, "atom table");
+	return t;
+}
+
+/* hashAtomBytes(bytes, n)
+ * Returns the hash of the n bytes at bytes used to place them in an
+ * atom table (FNV-1a).
+ */
+uint32_t
+hashAtomBytes(uint8_t *bytes, size_t n)
+{
+	uint32_t h = 2166136261U;
+	while (n-- > 0)
+		h = (h ^ *bytes++) * 16777619U;
+	return h;
+}
+
+/* growAtomTable(t)
+ * Doubles the number of slots of atom table t, placing its atoms again.
+ */
+static void
+growAtomTable(sexpAtomTable *t)
+{
+	sexpSimpleString **slots, *ss;
+	size_t i, j, mask = 2 * t->size - 1;
+	slots = calloc(2 * t->size, sizeof (sexpSimpleString *));
+	if (slots == NULL)
+		outOfMemory(NULL, "atom table");
+	for (i = 0; i < t->size; i++) {
+		if ((ss = t->slots[i]) == NULL)
+			continue;
+		j = hashAtomBytes(ss->string, ss->length) & mask;
+		while (slots[j] != NULL)
+			j = (j + 1) & mask;
+		slots[j] = ss;
+	}
+	free(t->slots);
+	t->slots = slots;
+	t->size *= 2;
+}
+
+/* internAtom(t, bytes, n)
+ * Returns the atom of table t holding the n bytes at bytes, adding it
+ * if it is new.  Returns NULL if n is 0 or more than MAXATOMLENGTH, or
+ * if the atom is new and the table is full.
+ */
+sexpSimpleString *
+internAtom(sexpAtomTable *t, uint8_t *bytes, size_t n)
+{
+	sexpSimpleString *ss;
+	size_t i, mask = t->size - 1;
+	if (n == 0 || n > MAXATOMLENGTH)
+		return NULL;
+	for (i = hashAtomBytes(bytes, n) & mask; (ss = t->slots[i]) != NULL;
+		 i = (i + 1) & mask)
+		if ((size_t) ss->length == n && memcmp(ss->string, bytes, n) == 0)
+			return ss;
+	if (t->count >= MAXATOMS)
+		return NULL;
+	ss = arenaAllocate(t->arena, sizeof (sexpSimpleString) + n);
+	ss->arena = t->arena;
+	borrowSimpleString(ss, (uint8_t *) (ss + 1), n);
+	memcpy(ss->string, bytes, n);
+	t->slots[i] = ss;
+	/* keep the table no more than half full */
+	if (++t->count > t->size / 2)
+		growAtomTable(t);
+	return ss;
+}
+
+/* freeSexpAtomTable(t)
+ * Frees atom table t and all its atoms.
+ */
+void
+freeSexpAtomTable(sexpAtomTable *t)
+{
+	freeSexpArena(t->arena);
+	free(t->slots);
+	free(t);
+}
+
 /****************************/
 /* SEXP STRING MANIPULATION */
 /****************************/
 
-/* newSexpString()
- * Creates and initializes a new sexpString object.
+/* newSexpString(a)
+ * Creates and initializes a new sexpString object in arena a.
  * Both the presentation hint and the string are initialized to NULL.
  */
 sexpString *
-newSexpString()
+newSexpString(sexpArena *a)
 {
 	sexpString *s;
-	s = malloc(sizeof (sexpString));
+	s = arenaAllocate(a, sizeof (sexpString));
 	s->type = SEXP_STRING;
 	s->presentationHint = NULL;
 	s->string = NULL;
+	s->cache = NULL;
 	return s;
 }
 
@@ -109,6 +454,9 @@ newSexpString()
 sexpSimpleString *
 sexpStringPresentationHint(sexpString *s)
 {
+	sexpTapeNode *node = (sexpTapeNode *) s;
+	if (isTapeNode(s))
+		return node->size == 5 ? (sexpSimpleString *) (node + 3) : NULL;
 	return s->presentationHint;
 }
 
@@ -119,6 +467,7 @@ void
 setSexpStringPresentationHint(sexpString *s, sexpSimpleString *ss)
 {
 	s->presentationHint = ss;
+	invalidateHashCache(s->cache);
 }
 
 /* setSexpStringString()
@@ -128,6 +477,7 @@ void
 setSexpStringString(sexpString *s, sexpSimpleString *ss)
 {
 	s->string = ss;
+	invalidateHashCache(s->cache);
 }
 
 /* sexpStringString()
@@ -136,6 +486,8 @@ setSexpStringString(sexpString *s, sexpSimpleString *ss)
 sexpSimpleString *
 sexpStringString(sexpString *s)
 {
+	if (isTapeNode(s))
+		return (sexpSimpleString *) ((sexpTapeNode *) s + 1);
 	return s->string;
 }
 
@@ -149,36 +501,69 @@ closeSexpString(sexpString *s) { (void)s; } /* do nothing in this implementation
 /* SEXP LIST MANIPULATION */
 /**************************/
 
-/* newSexpList()
- * Creates and initializes a new sexpList object.
+/* newSexpList(a)
+ * Creates and initializes a new sexpList object in arena a.
  * Both the first and rest fields are initialized to NULL, which is
  * SEXP's representation of an empty list.
  */
 sexpList *
-newSexpList()
+newSexpList(sexpArena *a)
 {
 	sexpList *list;
-	list = malloc(sizeof (sexpList));
+	list = arenaAllocate(a, sizeof (sexpList));
+	if (a != NULL)
+		SEXP_COUNT(a->stats, cells, 1);
 	list->type = SEXP_LIST;
 	list->first = NULL;
 	list->rest = NULL;
+	list->cache = NULL;
 	return list;
 }
 
 /* sexpAddSexpListObject()
- * Add object to end of list
+ * Add object to end of list; the new cell comes from malloc.
+ * Walks the whole list to find its end; use sexpAppendSexpListObject()
+ * when building a long list one element at a time.
  */
 void
 sexpAddSexpListObject(sexpList *list, sexpObject *object)
 {
-	if (list->first == NULL)
-		list->first = object;
-	else {
-		while (list->rest != NULL)
-			list = list->rest;
-		list->rest = newSexpList();
+	while (list->rest != NULL)
 		list = list->rest;
-		list->first = object;
+	sexpAppendSexpListObject(NULL, list, object);
+}
+
+/* sexpAppendSexpListObject(a, tail, object)
+ * Add object after tail, which must be the last cell of a list,
+ * and return the new last cell, allocated in arena a.  A caller that
+ * keeps the returned tail can build a list in time linear in its length.
+ */
+sexpList *
+sexpAppendSexpListObject(sexpArena *a, sexpList *tail, sexpObject *object)
+{
+	invalidateHashCache(tail->cache);
+	if (tail->first == NULL) {
+		tail->first = object;
+		return tail;
+	}
+	tail->rest = newSexpList(a);
+	tail->rest->first = object;
+	tail->rest->cache = tail->cache;	/* the cells of a list share one */
+	return tail->rest;
+}
+
+/* invalidateHashCache(c)
+ * Marks hash cache c, of an object that has changed, as out of date,
+ * along with those of the lists the object is in, up to the one at the
+ * top.  Those of lists further up are already out of date if c is.
+ */
+void
+invalidateHashCache(sexpHashCache *c)
+{
+	for (; c != NULL && c->valid; c = c->parent) {
+		c->valid = false;
+		c->treeAlgorithm = 0;
+		c->digestAlgorithm = 0;
 	}
 }
 
@@ -195,10 +580,16 @@ closeSexpList(sexpList *list) { (void)list; } /* nothing in this implementation
 
 /* sexpListIter()
  * return the iterator for going over a list 
+ * (a lazy list is scanned now, if it hasn't been)
  */
 sexpIter *
 sexpListIter(sexpList *list)
 {
+	sexpTapeNode *node = (sexpTapeNode *) list;
+	if (objectType(list) == SEXP_LAZY_LIST)
+		return (sexpIter *) scanLazyList((sexpLazyList *) list);
+	if (isTapeNode(list))
+		return node->size == 1 ? NULL : (sexpIter *) (node + 1);
 	return (sexpIter *) list;
 }
 
@@ -208,8 +599,11 @@ sexpListIter(sexpList *list)
 sexpIter *
 sexpIterNext(sexpIter *iter)
 {
+	sexpTapeNode *node = (sexpTapeNode *) iter;
 	if (iter == NULL)
 		return NULL;
+	if (isTapeNode(iter))
+		return node->type & SEXP_TAPE_LAST ? NULL : (sexpIter *) (node + node->size);
 	return (sexpIter *) ((sexpList *) iter)->rest;
 }
 
@@ -221,17 +615,21 @@ sexpIterObject(sexpIter *iter)
 {
 	if (iter == NULL)
 		return NULL;
+	if (isTapeNode(iter))
+		return (sexpObject *) iter;	/* a tape iterator is at the item */
 	return ((sexpList *) iter)->first;
 }
 
 int
 isObjectString(sexpObject *object)
 {
-	return ((sexpString *) object)->type == SEXP_STRING;
+	return objectType(object) == SEXP_STRING
+		|| objectType(object) == SEXP_TAPE_STRING;
 }
 
 int
 isObjectList(sexpObject *object)
 {
-	return ((sexpList *) object)->type == SEXP_LIST;
+	return objectType(object) == SEXP_LIST || objectType(object) == SEXP_TAPE_LIST
+		|| objectType(object) == SEXP_LAZY_LIST;
 }
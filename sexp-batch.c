@@ -0,0 +1,285 @@
+#include "sexp.h"
+
+/**************/
+/* BATCH MODE */
+/**************/
+
+/* In batch mode (-j) the main thread cuts the input into jobs of whole
+ * objects, using findObjectEnd() rather than parsing, and a pool of
+ * workers parses and prints each job into memory.  The main thread
+ * writes out what they printed in input order.
+ */
+
+/* newSexpBatch(workers)
+ * Creates the state shared with a pool of that many workers.
+ */
+sexpBatch *
+newSexpBatch(int workers)
+{
+	sexpBatch *b;
+	b = malloc(sizeof (sexpBatch));
+	if (b == NULL)
+		err(1, "%s", "Can't allocate batch");
+	b->size = 4 * workers;
+	b->jobs = malloc(b->size * sizeof (sexpBatchJob));
+	if (b->jobs == NULL)
+		err(1, "%s", "Can't allocate batch jobs");
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->queuedJob, NULL);
+	pthread_cond_init(&b->doneJob, NULL);
+	b->written = b->started = b->queued = 0;
+	b->finished = false;
+	b->os = NULL;
+	b->copyInput = false;
+	b->canonical = b->base64 = b->advanced = b->tapes = b->lazy = false;
+	b->atoms = false;
+	b->maxcolumn = DEFAULTLINELENGTH;
+	b->maxDepth = -1;
+	b->query = NULL;
+	b->hash = 0;
+	b->stats = NULL;
+	return b;
+}
+
+/* batchPrintJob(b, job, is, os)
+ * Parses the objects of job with is, and prints them with os into
+ * memory, in the formats of b, or what its query selects of them.
+ * Stops at the first error, recording it.
+ */
+void
+batchPrintJob(sexpBatch *b, sexpBatchJob *job, sexpInputStream *is,
+	sexpOutputStream *os)
+{
+	sexpObject *object;
+	sexpIter *iter;
+	jmp_buf onError;
+	int code, phase;
+	resetSexpMemoryInputStream(is, job->input, job->length);
+	is->count = job->offset - 1;	/* so errors give offsets in the input */
+	is->maxDepth = b->maxDepth;
+	is->tapes = b->tapes;
+	is->lazy = b->lazy;
+	os->outputFile = open_memstream(&job->output, &job->outputLength);
+	if (os->outputFile == NULL)
+		err(1, "%s", "Can't open output buffer");
+	os->column = 0;
+	while ((code = sexpParseObject(is, &object)) == SEXP_OK) {
+		/* lists left to be scanned later may hold errors too */
+		is->onError = &onError;
+		if (setjmp(onError) != 0) {
+			code = is->error;
+			break;
+		}
+		phase = SEXP_ENTER(os->stats, SEXP_PHASE_PRINT);
+		/* with a query, the objects printed are those it selects */
+		iter = NULL;
+		if (b->query != NULL) {
+			iter = sexpListIter(sexpQuery(is->arena, object, b->query));
+			object = sexpIterObject(iter);
+		}
+		while (object != NULL) {
+			if (b->canonical) {
+				changeOutputByteSize(os, 8, CANONICAL);
+				canonicalPrintObject(os, object);
+				os->newLine(os, ADVANCED);
+			}
+			if (b->base64) {
+				base64PrintWholeObject(os, object);
+				os->newLine(os, ADVANCED);
+			}
+			if (b->advanced) {
+				changeOutputByteSize(os, 8, ADVANCED);
+				advancedPrintObject(os, object);
+				os->newLine(os, ADVANCED);
+			}
+			if (b->hash) {
+				hashPrintObject(os, object, b->hash);
+				os->newLine(os, ADVANCED);
+			}
+			iter = sexpIterNext(iter);
+			object = sexpIterObject(iter);
+		}
+		SEXP_LEAVE(os->stats, phase);
+		releaseSexpArena(is->arena);
+	}
+	is->onError = NULL;
+	job->error = code == SEXP_EOF ? SEXP_OK : code;
+	strcpy(job->errorMessage, is->errorMessage);
+	fclose(os->outputFile);
+}
+
+/* batchWorker(b)
+ * Body of a worker thread: does the jobs queued in b, as they come,
+ * until b is finished.
+ */
+void *
+batchWorker(void *data)
+{
+	sexpBatch *b = data;
+	sexpBatchJob *job;
+	sexpInputStream *is;
+	sexpOutputStream *os;
+	is = newSexpMemoryInputStream(NULL, 0);
+	if (b->atoms)
+		is->atoms = newSexpAtomTable();
+	os = newSexpOutputStream();
+	os->maxcolumn = b->maxcolumn;
+	/* each worker counts on its own, and adds its counts at the end */
+	if (b->stats != NULL)
+		is->stats = is->arena->stats = os->stats = newSexpStats();
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		while (b->started == b->queued && !b->finished)
+			pthread_cond_wait(&b->queuedJob, &b->lock);
+		if (b->started == b->queued) {
+			if (os->stats != NULL)
+				addSexpStats(b->stats, os->stats);
+			pthread_mutex_unlock(&b->lock);
+			break;
+		}
+		job = &b->jobs[b->started++ % b->size];
+		pthread_mutex_unlock(&b->lock);
+
+		batchPrintJob(b, job, is, os);
+
+		pthread_mutex_lock(&b->lock);
+		job->done = true;
+		pthread_cond_signal(&b->doneJob);
+		pthread_mutex_unlock(&b->lock);
+	}
+	freeSexpInputStream(is);
+	free(os->stats);
+	free(os->layout);
+	free(os->stack);
+	free(os);
+	return NULL;
+}
+
+/* batchWriteJobs(b, all)
+ * Writes the output of the jobs of b that are done, in order.
+ * Waits for jobs only while the ring is full, or, if all, until every
+ * job queued has been written.  Exits at the first job with an error,
+ * after writing what was printed before it.
+ */
+void
+batchWriteJobs(sexpBatch *b, int all)
+{
+	sexpBatchJob *job;
+	pthread_mutex_lock(&b->lock);
+	while (b->written < b->queued) {
+		job = &b->jobs[b->written % b->size];
+		if (!job->done) {
+			if (!all && b->queued - b->written < b->size)
+				break;
+			pthread_cond_wait(&b->doneJob, &b->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&b->lock);
+		fwrite(job->output, 1, job->outputLength, b->os->outputFile);
+		free(job->output);
+		free(job->copy);
+		if (job->error != SEXP_OK) {
+			fflush(b->os->outputFile);
+			errx(1, "%s", job->errorMessage);
+		}
+		pthread_mutex_lock(&b->lock);
+		b->written++;
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+/* batchQueueJob(b, input, length, offset)
+ * Queues the length bytes at input, which are at offset in the whole
+ * input, as a job for the workers, writing out finished jobs first if
+ * the ring is full.
+ */
+void
+batchQueueJob(sexpBatch *b, uint8_t *input, size_t length, long int offset)
+{
+	sexpBatchJob *job;
+	batchWriteJobs(b, false);
+	pthread_mutex_lock(&b->lock);
+	job = &b->jobs[b->queued % b->size];
+	job->copy = NULL;
+	if (b->copyInput) {
+		job->copy = malloc(length);
+		if (job->copy == NULL)
+			err(1, "%s", "Can't allocate batch job");
+		memcpy(job->copy, input, length);
+		input = job->copy;
+	}
+	job->input = input;
+	job->length = length;
+	job->offset = offset;
+	job->output = NULL;
+	job->outputLength = 0;
+	job->error = SEXP_OK;
+	job->done = false;
+	b->queued++;
+	pthread_cond_signal(&b->queuedJob);
+	pthread_mutex_unlock(&b->lock);
+}
+
+/* batchQueueObjects(b, data, length, offset, all)
+ * Queues the whole objects at the start of data, which is at offset
+ * in the input, as jobs of about BATCHJOBSIZE bytes, for readObjects().
+ * If all, whatever follows them goes in the last job, to be reported.
+ * Returns the number of bytes queued.
+ */
+size_t
+batchQueueObjects(sexpBatch *b, uint8_t *data, size_t length,
+	long int offset, int all)
+{
+	size_t start, end = 0;
+	long int objectEnd = 0;
+	while (objectEnd >= 0 && end < length) {
+		start = end;
+		while (end - start < BATCHJOBSIZE
+			&& (objectEnd = findObjectEnd(data, length, end, NULL)) >= 0)
+			end = objectEnd;
+		if (objectEnd < 0 && all)
+			end = length;
+		if (end > start)
+			batchQueueJob(b, data + start, end - start, offset + start);
+	}
+	/* don't hold output back while waiting for more input */
+	batchWriteJobs(b, false);
+	fflush(b->os->outputFile);
+	return end;
+}
+
+/* batchProcess(b, is, os, workers)
+ * Reads all the objects of is and prints them to os, with a pool of
+ * that many workers.  Exits if the input can't be read, after writing
+ * what was printed of the objects before.
+ */
+void
+batchProcess(sexpBatch *b, sexpInputStream *is, sexpOutputStream *os,
+	int workers)
+{
+	pthread_t *threads;
+	int i, code;
+	threads = malloc(workers * sizeof (pthread_t));
+	if (threads == NULL)
+		err(1, "%s", "Can't allocate workers");
+	for (i = 0; i < workers; i++)
+		if (pthread_create(&threads[i], NULL, batchWorker, b) != 0)
+			err(1, "%s", "Can't start worker");
+
+	b->os = os;
+	b->copyInput = !is->mapped;
+	code = readObjects(is, batchQueueObjects, b);
+
+	pthread_mutex_lock(&b->lock);
+	b->finished = true;
+	pthread_cond_broadcast(&b->queuedJob);
+	pthread_mutex_unlock(&b->lock);
+	batchWriteJobs(b, true);
+	for (i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	if (code != SEXP_OK) {
+		fflush(os->outputFile);
+		errx(1, "%s", is->errorMessage);
+	}
+}
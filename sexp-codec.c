@@ -0,0 +1,649 @@
+#include "sexp.h"
+
+/* Block encoders and decoders for the 4-bit (hexadecimal) and 6-bit
+ * (base64) regions, and a search for the characters that give input
+ * its structure.  Each comes in a portable version and, on x86, in SSE
+ * and AVX2 versions that are chosen at run time by what the CPU
+ * supports.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEXP_X86
+#include <immintrin.h>
+#endif
+
+static const char *hexDigits = "0123456789ABCDEF";
+static const char *base64Digits =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/************/
+/* PORTABLE */
+/************/
+
+/* encodeBase64Scalar(dst, src, n)
+ * Encodes n bytes at src, n a multiple of 3, as base64 at dst.
+ */
+static long int
+encodeBase64Scalar(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	unsigned long int w;
+	for (i = 0; i + 3 <= n; i += 3) {
+		w = (unsigned long int) src[i] << 16 | src[i + 1] << 8 | src[i + 2];
+		*dst++ = base64Digits[(w >> 18) & 0x3F];
+		*dst++ = base64Digits[(w >> 12) & 0x3F];
+		*dst++ = base64Digits[(w >> 6) & 0x3F];
+		*dst++ = base64Digits[w & 0x3F];
+	}
+	return 4 * (n / 3);
+}
+
+/* encodeHexScalar(dst, src, n)
+ * Encodes n bytes at src as hexadecimal at dst.
+ */
+static long int
+encodeHexScalar(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	for (i = 0; i < n; i++) {
+		*dst++ = hexDigits[src[i] >> 4];
+		*dst++ = hexDigits[src[i] & 0x0F];
+	}
+	return 2 * n;
+}
+
+#ifdef SEXP_X86
+
+/*******/
+/* SSE */
+/*******/
+
+/* The base64 kernels spread each 3 input bytes over 4 bytes holding
+ * one 6-bit value each, then add to each value the offset of its range
+ * of the alphabet, looked up by range with a byte shuffle.
+ */
+
+__attribute__((target("ssse3")))
+static __m128i
+base64Translate128(__m128i in)
+{
+	__m128i offsets, indices;
+	offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+		-4, -4, -4, -4, -19, -16, 0, 0);
+	indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+	indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+	return _mm_add_epi8(in, _mm_shuffle_epi8(offsets, indices));
+}
+
+/* encodeBase64SSSE3(dst, src, n)
+ * Encodes 12 bytes at a time; each load reads 4 bytes more than that,
+ * so the last 16 bytes are left to the portable version.
+ */
+__attribute__((target("ssse3")))
+static long int
+encodeBase64SSSE3(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	__m128i in, t0, t1;
+	for (i = 0; i + 16 <= n; i += 12) {
+		in = _mm_loadu_si128((__m128i *) (src + i));
+		in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+			7, 6, 8, 7, 10, 9, 11, 10));
+		t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+			_mm_set1_epi32(0x04000040));
+		t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+			_mm_set1_epi32(0x01000010));
+		_mm_storeu_si128((__m128i *) dst,
+			base64Translate128(_mm_or_si128(t0, t1)));
+		dst += 16;
+	}
+	return 4 * (i / 3) + encodeBase64Scalar(dst, src + i, n - i);
+}
+
+/* hexTranslate128(nibbles)
+ * Turns each nibble into its hexadecimal digit.
+ */
+__attribute__((target("sse2")))
+static __m128i
+hexTranslate128(__m128i nibbles)
+{
+	__m128i letters;
+	letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+		_mm_set1_epi8('A' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/* encodeHexSSE2(dst, src, n)
+ * Encodes 16 bytes at a time.
+ */
+__attribute__((target("sse2")))
+static long int
+encodeHexSSE2(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	__m128i in, hi, lo, mask;
+	mask = _mm_set1_epi8(0x0F);
+	for (i = 0; i + 16 <= n; i += 16) {
+		in = _mm_loadu_si128((__m128i *) (src + i));
+		hi = hexTranslate128(_mm_and_si128(_mm_srli_epi16(in, 4), mask));
+		lo = hexTranslate128(_mm_and_si128(in, mask));
+		_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi8(hi, lo));
+		dst += 32;
+	}
+	return 2 * i + encodeHexScalar(dst, src + i, n - i);
+}
+
+/********/
+/* AVX2 */
+/********/
+
+__attribute__((target("avx2")))
+static __m256i
+base64Translate256(__m256i in)
+{
+	__m256i offsets, indices;
+	offsets = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+		-4, -4, -4, -4, -19, -16, 0, 0,
+		65, 71, -4, -4, -4, -4, -4, -4,
+		-4, -4, -4, -4, -19, -16, 0, 0);
+	indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+	indices = _mm256_sub_epi8(indices,
+		_mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
+	return _mm256_add_epi8(in, _mm256_shuffle_epi8(offsets, indices));
+}
+
+/* encodeBase64AVX2(dst, src, n)
+ * Encodes 24 bytes at a time, 12 in each half of a register; the load
+ * for the upper half reads 4 bytes more than it uses.
+ */
+__attribute__((target("avx2")))
+static long int
+encodeBase64AVX2(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	__m256i in, t0, t1;
+	for (i = 0; i + 28 <= n; i += 24) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *) (src + i))),
+			_mm_loadu_si128((__m128i *) (src + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+			1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+			1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+		t0 = _mm256_mulhi_epu16(
+			_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+			_mm256_set1_epi32(0x04000040));
+		t1 = _mm256_mullo_epi16(
+			_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+			_mm256_set1_epi32(0x01000010));
+		_mm256_storeu_si256((__m256i *) dst,
+			base64Translate256(_mm256_or_si256(t0, t1)));
+		dst += 32;
+	}
+	return 4 * (i / 3) + encodeBase64SSSE3(dst, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static __m256i
+hexTranslate256(__m256i nibbles)
+{
+	__m256i letters;
+	letters = _mm256_and_si256(
+		_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+		_mm256_set1_epi8('A' - '0' - 10));
+	return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')),
+		letters);
+}
+
+/* encodeHexAVX2(dst, src, n)
+ * Encodes 32 bytes at a time.  Interleaving works within each half of
+ * a register, so the halves are put back in order before storing.
+ */
+__attribute__((target("avx2")))
+static long int
+encodeHexAVX2(uint8_t *dst, uint8_t *src, long int n)
+{
+	long int i;
+	__m256i in, hi, lo, a, b, mask;
+	mask = _mm256_set1_epi8(0x0F);
+	for (i = 0; i + 32 <= n; i += 32) {
+		in = _mm256_loadu_si256((__m256i *) (src + i));
+		hi = hexTranslate256(_mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+		lo = hexTranslate256(_mm256_and_si256(in, mask));
+		a = _mm256_unpacklo_epi8(hi, lo);
+		b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *) (dst + 32),
+			_mm256_permute2x128_si256(a, b, 0x31));
+		dst += 64;
+	}
+	return 2 * i + encodeHexSSE2(dst, src + i, n - i);
+}
+
+#endif /* SEXP_X86 */
+
+/************/
+/* ENCODING */
+/************/
+
+/* encodeBase64(dst, src, n)
+ * Encodes the n bytes at src, n a multiple of 3, as 4n/3 base64
+ * characters at dst.  Returns the number of characters.
+ */
+long int
+encodeBase64(uint8_t *dst, uint8_t *src, long int n)
+{
+#ifdef SEXP_X86
+	if (__builtin_cpu_supports("avx2"))
+		return encodeBase64AVX2(dst, src, n);
+	if (__builtin_cpu_supports("ssse3"))
+		return encodeBase64SSSE3(dst, src, n);
+#endif
+	return encodeBase64Scalar(dst, src, n);
+}
+
+/* encodeHex(dst, src, n)
+ * Encodes the n bytes at src as 2n hexadecimal digits at dst.
+ * Returns the number of digits.
+ */
+long int
+encodeHex(uint8_t *dst, uint8_t *src, long int n)
+{
+#ifdef SEXP_X86
+	if (__builtin_cpu_supports("avx2"))
+		return encodeHexAVX2(dst, src, n);
+	if (__builtin_cpu_supports("sse2"))
+		return encodeHexSSE2(dst, src, n);
+#endif
+	return encodeHexScalar(dst, src, n);
+}
+
+/************/
+/* DECODING */
+/************/
+
+/* Decoders turn characters into bytes until they run out of characters
+ * or meet one that is not a digit and can't be skipped, which is where
+ * a region ends (or is in error).  White space is skipped, as is '=' in
+ * base64.  Bits of a partly decoded byte are carried in *bits and
+ * *nBits from one call to the next.
+ */
+
+#define SKIP 64		/* character to be skipped */
+#define STOP 255	/* character that stops decoding */
+
+/* base64Values[c] is value of c as base64 digit, or SKIP or STOP */
+const uint8_t base64Values[256] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255,  64,  64,  64,  64,  64, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	 64, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+	 52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255,  64, 255, 255,
+	255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+	 15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+	255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+	 41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+/* hexValues[c] is value of c as hex digit, or SKIP or STOP */
+const uint8_t hexValues[256] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255,  64,  64,  64,  64,  64, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	 64, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	  0,   1,   2,   3,   4,   5,   6,   7,   8,   9, 255, 255, 255, 255, 255, 255,
+	255,  10,  11,  12,  13,  14,  15, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255,  10,  11,  12,  13,  14,  15, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+/* decodeScalar(dst, length, src, n, bits, nBits, values, byteSize)
+ * Decodes with the given table of digit values, byteSize bits a digit.
+ * Stores the number of bytes decoded in *length.
+ * Returns the number of characters used.
+ */
+static long int
+decodeScalar(uint8_t *dst, long int *length, uint8_t *src, long int n,
+	int *bits, int *nBits, const uint8_t *values, int byteSize)
+{
+	long int i;
+	int v;
+	uint8_t *d = dst;
+	for (i = 0; i < n; i++) {
+		v = values[src[i]];
+		if (v == SKIP)
+			continue;
+		if (v == STOP)
+			break;
+		*bits = ((*bits << byteSize) | v) & 0xFFFF;
+		*nBits += byteSize;
+		if (*nBits >= 8) {
+			*nBits -= 8;
+			*d++ = (*bits >> *nBits) & 0xFF;
+		}
+	}
+	*length = d - dst;
+	return i;
+}
+
+/* decodeBlocks(dst, length, src, n, bits, nBits, values, byteSize, kernel)
+ * Decodes with kernel, which decodes a block of 32 characters that are
+ * all digits (returning false, having stored nothing, if they are not),
+ * wherever no partly decoded byte is pending.  Everything else is left
+ * to decodeScalar().  The kernel may store up to 8 bytes more than it
+ * decodes.
+ */
+static long int
+decodeBlocks(uint8_t *dst, long int *length, uint8_t *src, long int n,
+	int *bits, int *nBits, const uint8_t *values, int byteSize,
+	int (*kernel)(uint8_t *, uint8_t *))
+{
+	long int i = 0, k, m, run;
+	uint8_t *d = dst;
+	int blockLength = 32 * byteSize / 8;
+	for (;;) {
+		if (*nBits == 0)
+			while (i + 32 <= n && kernel(d, src + i)) {
+				i += 32;
+				d += blockLength;
+			}
+		/* past the block that is not all digits, and on to a byte edge */
+		run = n - i < 32 ? n - i : 32;
+		k = decodeScalar(d, &m, src + i, run, bits, nBits, values, byteSize);
+		i += k;
+		d += m;
+		while (k == run && i < n && *nBits != 0) {
+			k = decodeScalar(d, &m, src + i, 1, bits, nBits, values, byteSize);
+			i += k;
+			d += m;
+			run = 1;
+		}
+		if (k < run || i >= n)
+			break;
+	}
+	*length = d - dst;
+	return i;
+}
+
+#ifdef SEXP_X86
+
+/* The base64 decoding kernels classify each character by its high and
+ * low nibbles, with one table each; a character is a digit if the
+ * classes share no bit.  The high nibble (and whether the character is
+ * '/') then selects the offset that turns it into its value.
+ */
+
+/* decodeBase64SSSE3Block(dst, src)
+ * Decodes 32 base64 digits into 24 bytes, 16 digits at a time.
+ */
+__attribute__((target("ssse3")))
+static int
+decodeBase64SSSE3Block(uint8_t *dst, uint8_t *src)
+{
+	__m128i in[2], hiNibbles, loNibbles, hi, lo, roll, mask;
+	int i;
+	mask = _mm_set1_epi8(0x2F);
+	for (i = 0; i < 2; i++) {
+		in[i] = _mm_loadu_si128((__m128i *) (src + 16 * i));
+		hiNibbles = _mm_and_si128(_mm_srli_epi32(in[i], 4), mask);
+		loNibbles = _mm_and_si128(in[i], mask);
+		hi = _mm_shuffle_epi8(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04,
+			0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+			hiNibbles);
+		lo = _mm_shuffle_epi8(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11,
+			0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A),
+			loNibbles);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+				_mm_setzero_si128())) != 0xFFFF)
+			return false;
+		roll = _mm_shuffle_epi8(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71,
+			-71, 0, 0, 0, 0, 0, 0, 0, 0),
+			_mm_add_epi8(_mm_cmpeq_epi8(in[i], mask), hiNibbles));
+		in[i] = _mm_add_epi8(in[i], roll);
+	}
+	for (i = 0; i < 2; i++) {
+		/* pack four 6-bit values into each 3 bytes */
+		in[i] = _mm_madd_epi16(_mm_maddubs_epi16(in[i],
+			_mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+		in[i] = _mm_shuffle_epi8(in[i], _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+			10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		_mm_storeu_si128((__m128i *) (dst + 12 * i), in[i]);
+	}
+	return true;
+}
+
+/* decodeHexSSE2Block(dst, src)
+ * Decodes 32 hex digits into 16 bytes.
+ */
+__attribute__((target("sse2")))
+static int
+decodeHexSSE2Block(uint8_t *dst, uint8_t *src)
+{
+	__m128i in, digit, letter, isDigit, isLetter, value[2];
+	int i;
+	for (i = 0; i < 2; i++) {
+		in = _mm_loadu_si128((__m128i *) (src + 16 * i));
+		digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+		letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)),
+			_mm_set1_epi8('a'));
+		isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+		isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)),
+			letter);
+		if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+			return false;
+		value[i] = _mm_or_si128(_mm_and_si128(isDigit, digit),
+			_mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+		/* each 16-bit lane holds two digits: high one first */
+		value[i] = _mm_or_si128(
+			_mm_slli_epi16(_mm_and_si128(value[i], _mm_set1_epi16(0x0F)), 4),
+			_mm_srli_epi16(value[i], 8));
+	}
+	_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(value[0], value[1]));
+	return true;
+}
+
+/* decodeBase64AVX2Block(dst, src)
+ * Decodes 32 base64 digits into 24 bytes.
+ */
+__attribute__((target("avx2")))
+static int
+decodeBase64AVX2Block(uint8_t *dst, uint8_t *src)
+{
+	__m256i in, hiNibbles, loNibbles, hi, lo, roll, mask;
+	mask = _mm256_set1_epi8(0x2F);
+	in = _mm256_loadu_si256((__m256i *) src);
+	hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask);
+	loNibbles = _mm256_and_si256(in, mask);
+	hi = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), hiNibbles);
+	lo = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A), loNibbles);
+	if (!_mm256_testz_si256(lo, hi))
+		return false;
+	roll = _mm256_shuffle_epi8(_mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+		_mm256_add_epi8(_mm256_cmpeq_epi8(in, mask), hiNibbles));
+	in = _mm256_add_epi8(in, roll);
+	/* pack four 6-bit values into each 3 bytes, then close the gap
+	 * between the two halves of the register */
+	in = _mm256_madd_epi16(_mm256_maddubs_epi16(in,
+		_mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+	in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+		7, 7));
+	_mm256_storeu_si256((__m256i *) dst, in);
+	return true;
+}
+
+#endif /* SEXP_X86 */
+
+/* decodeBase64(dst, length, src, n, bits, nBits)
+ * Decodes base64 at src, up to n characters, into dst, which must have
+ * room for 3n/4 + 32 bytes.  Stores the number of bytes decoded in
+ * *length.  Returns the number of characters used.
+ */
+long int
+decodeBase64(uint8_t *dst, long int *length, uint8_t *src, long int n,
+	int *bits, int *nBits)
+{
+#ifdef SEXP_X86
+	if (__builtin_cpu_supports("avx2"))
+		return decodeBlocks(dst, length, src, n, bits, nBits, base64Values, 6,
+			decodeBase64AVX2Block);
+	if (__builtin_cpu_supports("ssse3"))
+		return decodeBlocks(dst, length, src, n, bits, nBits, base64Values, 6,
+			decodeBase64SSSE3Block);
+#endif
+	return decodeScalar(dst, length, src, n, bits, nBits, base64Values, 6);
+}
+
+/* decodeHex(dst, length, src, n, bits, nBits)
+ * Decodes hexadecimal at src, up to n characters, into dst, which must
+ * have room for n/2 + 32 bytes.  Stores the number of bytes decoded in
+ * *length.  Returns the number of characters used.
+ */
+long int
+decodeHex(uint8_t *dst, long int *length, uint8_t *src, long int n,
+	int *bits, int *nBits)
+{
+#ifdef SEXP_X86
+	if (__builtin_cpu_supports("sse2"))
+		return decodeBlocks(dst, length, src, n, bits, nBits, hexValues, 4,
+			decodeHexSSE2Block);
+#endif
+	return decodeScalar(dst, length, src, n, bits, nBits, hexValues, 4);
+}
+
+/*************/
+/* STRUCTURE */
+/*************/
+
+#ifdef SEXP_X86
+
+/* structuralMask128(in)
+ * Returns a bit for each of the 16 characters in that is structural.
+ */
+__attribute__((target("sse2")))
+static int
+structuralMask128(__m128i in)
+{
+	__m128i digit, found;
+	digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+	found = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('(')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8(')')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('"')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('|')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('#')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('{')));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(in, _mm_set1_epi8('[')));
+	return _mm_movemask_epi8(found);
+}
+
+/* findStructuralSSE2(src, n)
+ * Looks at 16 characters at a time.
+ */
+__attribute__((target("sse2")))
+static long int
+findStructuralSSE2(uint8_t *src, long int n)
+{
+	long int i;
+	int mask;
+	for (i = 0; i + 16 <= n; i += 16) {
+		mask = structuralMask128(_mm_loadu_si128((__m128i *) (src + i)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	while (i < n && !(charClass[src[i]] & SEXP_STRUCTURAL))
+		i++;
+	return i;
+}
+
+/* findStructuralAVX2(src, n)
+ * Looks at 32 characters at a time.
+ */
+__attribute__((target("avx2")))
+static long int
+findStructuralAVX2(uint8_t *src, long int n)
+{
+	long int i;
+	unsigned int mask;
+	__m256i in, digit, found;
+	for (i = 0; i + 32 <= n; i += 32) {
+		in = _mm256_loadu_si256((__m256i *) (src + i));
+		digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+		found = _mm256_cmpeq_epi8(_mm256_min_epu8(digit,
+			_mm256_set1_epi8(9)), digit);
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('(')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8(')')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('|')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('#')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('{')));
+		found = _mm256_or_si256(found,
+			_mm256_cmpeq_epi8(in, _mm256_set1_epi8('[')));
+		mask = _mm256_movemask_epi8(found);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i + findStructuralSSE2(src + i, n - i);
+}
+
+#endif /* SEXP_X86 */
+
+/* findStructural(src, n)
+ * Returns the index of the first of the n characters at src that can
+ * begin or end an item of a list, other than a token or white space:
+ * a parenthesis, a quote, |, #, {, [ or a decimal digit.  Returns n if
+ * there is none.
+ */
+long int
+findStructural(uint8_t *src, long int n)
+{
+	long int i = 0;
+	/* the next one is most often close by */
+	while (i < n && i < 8) {
+		if (charClass[src[i]] & SEXP_STRUCTURAL)
+			return i;
+		i++;
+	}
+#ifdef SEXP_X86
+	if (__builtin_cpu_supports("avx2"))
+		return i + findStructuralAVX2(src + i, n - i);
+	if (__builtin_cpu_supports("sse2"))
+		return i + findStructuralSSE2(src + i, n - i);
+#endif
+	while (i < n && !(charClass[src[i]] & SEXP_STRUCTURAL))
+		i++;
+	return i;
+}
@@ -0,0 +1,603 @@
+#include "sexp.h"
+
+/* Hashes of the canonical forms of objects, which is what the canonical
+ * form is for.  The canonical printer is run with an output stream
+ * whose putChar and putBytes feed a hash instead of a file, so nothing
+ * is printed along the way.  SHA-256 uses the SHA extensions on x86
+ * when the CPU has them, chosen at run time.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEXP_X86
+#include <immintrin.h>
+#endif
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* loadWord(p)
+ * Returns the big-endian 32-bit word at p.
+ */
+static uint32_t
+loadWord(uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16
+		| (uint32_t) p[2] << 8 | p[3];
+}
+
+/*********/
+/* SHA-1 */
+/*********/
+
+/* one round of SHA-1, with f the round's function of b, c and d */
+#define SHA1ROUND(a, b, c, d, e, f, k, w) \
+	e += ROTL(a, 5) + (f) + (k) + (w); \
+	b = ROTL(b, 30)
+
+/* sha1Blocks(state, blocks, n)
+ * Adds the n 64-byte blocks at blocks to the SHA-1 state.
+ */
+static void
+sha1Blocks(uint32_t *state, uint8_t *blocks, size_t n)
+{
+	uint32_t w[80], a, b, c, d, e;
+	int i;
+	for (; n > 0; n--, blocks += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = loadWord(blocks + 4 * i);
+		for (; i < 80; i++)
+			w[i] = ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		/* five rounds at a time bring the variables back into place */
+		for (i = 0; i < 20; i += 5) {
+			SHA1ROUND(a, b, c, d, e, d ^ (b & (c ^ d)), 0x5A827999, w[i]);
+			SHA1ROUND(e, a, b, c, d, c ^ (a & (b ^ c)), 0x5A827999, w[i + 1]);
+			SHA1ROUND(d, e, a, b, c, b ^ (e & (a ^ b)), 0x5A827999, w[i + 2]);
+			SHA1ROUND(c, d, e, a, b, a ^ (d & (e ^ a)), 0x5A827999, w[i + 3]);
+			SHA1ROUND(b, c, d, e, a, e ^ (c & (d ^ e)), 0x5A827999, w[i + 4]);
+		}
+		for (; i < 40; i += 5) {
+			SHA1ROUND(a, b, c, d, e, b ^ c ^ d, 0x6ED9EBA1, w[i]);
+			SHA1ROUND(e, a, b, c, d, a ^ b ^ c, 0x6ED9EBA1, w[i + 1]);
+			SHA1ROUND(d, e, a, b, c, e ^ a ^ b, 0x6ED9EBA1, w[i + 2]);
+			SHA1ROUND(c, d, e, a, b, d ^ e ^ a, 0x6ED9EBA1, w[i + 3]);
+			SHA1ROUND(b, c, d, e, a, c ^ d ^ e, 0x6ED9EBA1, w[i + 4]);
+		}
+		for (; i < 60; i += 5) {
+			SHA1ROUND(a, b, c, d, e, (b & c) | (d & (b | c)), 0x8F1BBCDC, w[i]);
+			SHA1ROUND(e, a, b, c, d, (a & b) | (c & (a | b)), 0x8F1BBCDC, w[i + 1]);
+			SHA1ROUND(d, e, a, b, c, (e & a) | (b & (e | a)), 0x8F1BBCDC, w[i + 2]);
+			SHA1ROUND(c, d, e, a, b, (d & e) | (a & (d | e)), 0x8F1BBCDC, w[i + 3]);
+			SHA1ROUND(b, c, d, e, a, (c & d) | (e & (c | d)), 0x8F1BBCDC, w[i + 4]);
+		}
+		for (; i < 80; i += 5) {
+			SHA1ROUND(a, b, c, d, e, b ^ c ^ d, 0xCA62C1D6, w[i]);
+			SHA1ROUND(e, a, b, c, d, a ^ b ^ c, 0xCA62C1D6, w[i + 1]);
+			SHA1ROUND(d, e, a, b, c, e ^ a ^ b, 0xCA62C1D6, w[i + 2]);
+			SHA1ROUND(c, d, e, a, b, d ^ e ^ a, 0xCA62C1D6, w[i + 3]);
+			SHA1ROUND(b, c, d, e, a, c ^ d ^ e, 0xCA62C1D6, w[i + 4]);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+/***********/
+/* SHA-256 */
+/***********/
+
+static const uint32_t sha256K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+	0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+	0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+	0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+	0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+	0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/* one round of SHA-256; the caller renames the variables after it */
+#define SHA256ROUND(a, b, c, d, e, f, g, h, i) \
+	t = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) \
+		+ (g ^ (e & (f ^ g))) + sha256K[i] + w[i]; \
+	d += t; \
+	h = t + (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) \
+		+ ((a & b) | (c & (a | b)))
+
+/* sha256Blocks(state, blocks, n)
+ * Adds the n 64-byte blocks at blocks to the SHA-256 state.
+ */
+static void
+sha256Blocks(uint32_t *state, uint8_t *blocks, size_t n)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, s0, s1, t;
+	int i;
+	for (; n > 0; n--, blocks += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = loadWord(blocks + 4 * i);
+		for (; i < 64; i++) {
+			s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+		/* eight rounds at a time bring the variables back into place */
+		for (i = 0; i < 64; i += 8) {
+			SHA256ROUND(a, b, c, d, e, f, g, h, i);
+			SHA256ROUND(h, a, b, c, d, e, f, g, i + 1);
+			SHA256ROUND(g, h, a, b, c, d, e, f, i + 2);
+			SHA256ROUND(f, g, h, a, b, c, d, e, i + 3);
+			SHA256ROUND(e, f, g, h, a, b, c, d, i + 4);
+			SHA256ROUND(d, e, f, g, h, a, b, c, i + 5);
+			SHA256ROUND(c, d, e, f, g, h, a, b, i + 6);
+			SHA256ROUND(b, c, d, e, f, g, h, a, i + 7);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SEXP_X86
+
+/* four rounds of SHA-256 with the SHA extensions, the message schedule
+ * for them being m0, which is first worked out from the 12 words before
+ * it, in m1, m2 and m3, after the first four groups of rounds */
+#define SHA256ROUNDS(m0, m1, m2, m3, i) \
+	if (i >= 4) \
+		m0 = _mm_sha256msg2_epu32(_mm_add_epi32( \
+			_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3); \
+	k = _mm_add_epi32(m0, _mm_loadu_si128((__m128i *) (sha256K + 4 * (i)))); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k); \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0E))
+
+/* sha256BlocksSHA(state, blocks, n)
+ * sha256Blocks with the SHA extensions, which do two rounds in one
+ * instruction.  They keep the state as ABEF and CDGH.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+sha256BlocksSHA(uint32_t *state, uint8_t *blocks, size_t n)
+{
+	__m128i abef, cdgh, abefSaved, cdghSaved, m[4], k, t;
+	const __m128i order = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+		4, 5, 6, 7, 0, 1, 2, 3);
+	int i;
+	t = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) state), 0xB1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *) (state + 4)), 0x1B);
+	abef = _mm_alignr_epi8(t, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, t, 0xF0);
+	for (; n > 0; n--, blocks += 64) {
+		abefSaved = abef;
+		cdghSaved = cdgh;
+		/* m holds the last 16 words of the message schedule */
+		for (i = 0; i < 4; i++)
+			m[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((__m128i *) (blocks + 16 * i)), order);
+		for (i = 0; i < 16; i += 4) {
+			SHA256ROUNDS(m[0], m[1], m[2], m[3], i);
+			SHA256ROUNDS(m[1], m[2], m[3], m[0], i + 1);
+			SHA256ROUNDS(m[2], m[3], m[0], m[1], i + 2);
+			SHA256ROUNDS(m[3], m[0], m[1], m[2], i + 3);
+		}
+		abef = _mm_add_epi32(abef, abefSaved);
+		cdgh = _mm_add_epi32(cdgh, cdghSaved);
+	}
+	t = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *) state, _mm_blend_epi16(t, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(cdgh, t, 8));
+}
+
+#endif /* SEXP_X86 */
+
+/***************/
+/* HASH STATES */
+/***************/
+
+/* hashAlgorithm(name)
+ * Returns the hash algorithm called name, or 0 if there is none.
+ */
+int
+hashAlgorithm(char *name)
+{
+	if (strcmp(name, "sha1") == 0 || strcmp(name, "sha-1") == 0)
+		return SEXP_SHA1;
+	if (strcmp(name, "sha256") == 0 || strcmp(name, "sha-256") == 0)
+		return SEXP_SHA256;
+	return 0;
+}
+
+/* initializeHash(h, algorithm)
+ * Starts h hashing with algorithm.
+ */
+void
+initializeHash(sexpHash *h, int algorithm)
+{
+	static const uint32_t sha1Start[5] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+	};
+	static const uint32_t sha256Start[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+		0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+	};
+	h->algorithm = algorithm;
+	if (algorithm == SEXP_SHA1) {
+		memcpy(h->state, sha1Start, sizeof sha1Start);
+		h->blocks = sha1Blocks;
+	} else {
+		memcpy(h->state, sha256Start, sizeof sha256Start);
+		h->blocks = sha256Blocks;
+#ifdef SEXP_X86
+		if (__builtin_cpu_supports("sha"))
+			h->blocks = sha256BlocksSHA;
+#endif
+	}
+	h->blockLength = 0;
+	h->length = 0;
+}
+
+/* hashBytes(h, bytes, n)
+ * Adds the n bytes at bytes to what h has hashed.
+ */
+void
+hashBytes(sexpHash *h, uint8_t *bytes, size_t n)
+{
+	size_t run;
+	h->length += n;
+	if (h->blockLength > 0) {
+		run = 64 - h->blockLength < n ? 64 - h->blockLength : n;
+		memcpy(h->block + h->blockLength, bytes, run);
+		h->blockLength += run;
+		bytes += run;
+		n -= run;
+		if (h->blockLength < 64)
+			return;
+		h->blocks(h->state, h->block, 1);
+		h->blockLength = 0;
+	}
+	/* whole blocks are hashed where they are */
+	h->blocks(h->state, bytes, n / 64);
+	memcpy(h->block, bytes + n / 64 * 64, n % 64);
+	h->blockLength = n % 64;
+}
+
+/* digestLength(algorithm)
+ * Returns the number of bytes in a digest made with algorithm.
+ */
+int
+digestLength(int algorithm)
+{
+	return algorithm == SEXP_SHA1 ? 20 : 32;
+}
+
+/* finishHash(h, digest)
+ * Puts the digest of what h has hashed at digest.
+ * Returns its length in bytes.
+ */
+int
+finishHash(sexpHash *h, uint8_t *digest)
+{
+	uint8_t pad[72];
+	uint64_t bits = h->length * 8;
+	size_t n;
+	int i, words = digestLength(h->algorithm) / 4;
+	/* a 1 bit, then 0 bits up to 8 bytes short of a block, then the
+	 * length in bits */
+	n = (h->blockLength < 56 ? 56 : 120) - h->blockLength;
+	memset(pad, 0, n);
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[n + i] = (uint8_t) (bits >> (56 - 8 * i));
+	hashBytes(h, pad, n + 8);
+	for (i = 0; i < words; i++) {
+		digest[4 * i] = (uint8_t) (h->state[i] >> 24);
+		digest[4 * i + 1] = (uint8_t) (h->state[i] >> 16);
+		digest[4 * i + 2] = (uint8_t) (h->state[i] >> 8);
+		digest[4 * i + 3] = (uint8_t) h->state[i];
+	}
+	return 4 * words;
+}
+
+/*****************************/
+/* HASHING THROUGH A PRINTER */
+/*****************************/
+
+/* hashPutChar(os, c)
+ * putChar for an output stream whose output is being hashed.
+ */
+void
+hashPutChar(sexpOutputStream *os, int c)
+{
+	sexpHash *h = os->hash;
+	uint8_t byte = (uint8_t) c;
+	if (h->blockLength < 63) {
+		h->block[h->blockLength++] = byte;
+		h->length++;
+	} else
+		hashBytes(h, &byte, 1);
+	os->column++;
+}
+
+/* hashPutBytes(os, bytes, n)
+ * putBytes for an output stream whose output is being hashed.
+ */
+void
+hashPutBytes(sexpOutputStream *os, uint8_t *bytes, long int n)
+{
+	hashBytes(os->hash, bytes, n);
+	os->column += n;
+}
+
+/* beginHash(os, h, algorithm)
+ * Makes what is printed in canonical form with os go into h, hashed
+ * with algorithm, until endHash().
+ */
+void
+beginHash(sexpOutputStream *os, sexpHash *h, int algorithm)
+{
+	initializeHash(h, algorithm);
+	h->putChar = os->putChar;
+	h->putBytes = os->putBytes;
+	os->hash = h;
+	os->putChar = hashPutChar;
+	os->putBytes = hashPutBytes;
+	changeOutputByteSize(os, 8, CANONICAL);
+}
+
+/* endHash(os, digest)
+ * Puts the digest of what was printed with os since beginHash() at
+ * digest, and makes os print as before.  Returns its length in bytes.
+ */
+int
+endHash(sexpOutputStream *os, uint8_t *digest)
+{
+	sexpHash *h = os->hash;
+	os->putChar = h->putChar;
+	os->putBytes = h->putBytes;
+	os->hash = NULL;
+	return finishHash(h, digest);
+}
+
+/* sexpHashObject(os, object, algorithm, digest)
+ * Puts the digest of the canonical form of object, hashed with
+ * algorithm, at digest, using os to walk it.  Returns its length.
+ */
+int
+sexpHashObject(sexpOutputStream *os, sexpObject *object, int algorithm,
+	uint8_t *digest)
+{
+	sexpHash h;
+	beginHash(os, &h, algorithm);
+	canonicalPrintObject(os, object);
+	return endHash(os, digest);
+}
+
+/***************/
+/* HASH CACHES */
+/***************/
+
+/* A canonical form can't be hashed again in part after a change, so
+ * the digest kept to make that cheap is a Merkle digest instead: that
+ * of a string is the digest of its canonical form, and that of a list
+ * is the digest of its items' digests, between ( and ).  Only the
+ * lists around something changed need hashing again.
+ */
+
+/* hashTreeString(h, s)
+ * Hashes the canonical form of string s with h, unless h is NULL.
+ * Returns its length.
+ */
+static long int
+hashTreeString(sexpHash *h, sexpString *s)
+{
+	sexpSimpleString *ss[2];
+	char length[32];
+	long int total = 0;
+	int i, n;
+	ss[0] = sexpStringPresentationHint(s);
+	ss[1] = sexpStringString(s);
+	for (i = 0; i < 2; i++) {
+		if (ss[i] == NULL)
+			continue;
+		n = sprintf(length, "%s%ld:", i == 0 ? "[" : "",
+			simpleStringLength(ss[i]));
+		total += n + simpleStringLength(ss[i]) + (i == 0);
+		if (h == NULL)
+			continue;
+		hashBytes(h, (uint8_t *) length, n);
+		hashBytes(h, simpleStringString(ss[i]), simpleStringLength(ss[i]));
+		if (i == 0)
+			hashBytes(h, (uint8_t *) "]", 1);
+	}
+	return total;
+}
+
+/* objectHashCache(object, a)
+ * Returns the hash cache of object, which is given one in arena a if
+ * it has none.  An object with no room for one, as in a tape, gets a
+ * new one each time.
+ */
+static sexpHashCache *
+objectHashCache(sexpObject *object, sexpArena *a)
+{
+	sexpHashCache **cache = NULL, *c;
+	if (objectType(object) == SEXP_STRING)
+		cache = &((sexpString *) object)->cache;
+	else if (objectType(object) == SEXP_LIST)
+		cache = &((sexpList *) object)->cache;
+	if (cache != NULL && *cache != NULL)
+		return *cache;
+	c = arenaAllocate(a, sizeof (sexpHashCache));
+	c->valid = false;
+	c->treeAlgorithm = c->digestAlgorithm = 0;
+	c->length = 0;
+	c->parent = NULL;
+	if (cache != NULL)
+		*cache = c;
+	return c;
+}
+
+/* sexpHashTree(object, algorithm, a)
+ * Returns the hash cache of object, bringing up to date the canonical
+ * lengths of it and everything in it and, unless algorithm is 0, their
+ * Merkle digests with algorithm.  New caches are put in arena a.  What
+ * is already up to date is not looked at again, so after a change only
+ * the lists around it are.
+ */
+sexpHashCache *
+sexpHashTree(sexpObject *object, int algorithm, sexpArena *a)
+{
+	sexpHashFrame *stack = NULL, *f;
+	long int stackSize = 0, depth = 0;
+	sexpHashCache *c;
+	sexpHash h;
+	for (;;) {
+		/* give object its hashes, if it needs them */
+		if (objectType(object) == SEXP_LAZY_LIST)
+			object = (sexpObject *) scanLazyList((sexpLazyList *) object);
+		c = objectHashCache(object, a);
+		if (c->valid && (algorithm == 0 || c->treeAlgorithm == algorithm))
+			;
+		else if (isObjectString(object) && algorithm == 0) {
+			/* valid, so that a change to it is passed up */
+			c->length = hashTreeString(NULL, (sexpString *) object);
+			c->treeAlgorithm = 0;
+			c->valid = true;
+		} else if (isObjectString(object)) {
+			initializeHash(&h, algorithm);
+			c->length = hashTreeString(&h, (sexpString *) object);
+			finishHash(&h, c->tree);
+			c->treeAlgorithm = algorithm;
+			c->valid = true;
+		} else {
+			/* the list is done once its items are */
+			if (depth == stackSize) {
+				stackSize = 16 + 2 * stackSize;
+				f = realloc(stack, stackSize * sizeof (sexpHashFrame));
+				if (f == NULL) {
+					free(stack);
+					outOfMemory(a, "hash stack");
+				}
+				stack = f;
+			}
+			f = &stack[depth++];
+			f->iter = sexpListIter((sexpList *) object);
+			f->cache = c;
+			c->length = 2;
+			if (algorithm != 0) {
+				initializeHash(&f->hash, algorithm);
+				hashBytes(&f->hash, (uint8_t *) "(", 1);
+			}
+			c = NULL;
+		}
+		/* add what is done to the lists it is in, and finish those
+		 * with no more items */
+		for (; depth > 0; depth--) {
+			f = &stack[depth - 1];
+			if (c != NULL) {
+				c->parent = f->cache;
+				f->cache->length += c->length;
+				if (algorithm != 0)
+					hashBytes(&f->hash, c->tree, digestLength(algorithm));
+				f->iter = sexpIterNext(f->iter);
+			}
+			if (f->iter != NULL && sexpIterObject(f->iter) != NULL)
+				break;
+			c = f->cache;
+			if (algorithm != 0) {
+				hashBytes(&f->hash, (uint8_t *) ")", 1);
+				finishHash(&f->hash, c->tree);
+			}
+			c->treeAlgorithm = algorithm;
+			c->valid = true;
+		}
+		if (depth == 0)
+			break;
+		/* the cells of a list share its cache */
+		if (objectType(f->iter) == SEXP_LIST)
+			((sexpList *) f->iter)->cache = f->cache;
+		object = sexpIterObject(f->iter);
+	}
+	free(stack);
+	return c;
+}
+
+/* sexpObjectDigest(os, object, algorithm, a)
+ * Returns the digest of the canonical form of object, hashed with
+ * algorithm, as sexpHashObject() does, but keeps it in the hash cache
+ * of object, in arena a, until object changes.
+ */
+uint8_t *
+sexpObjectDigest(sexpOutputStream *os, sexpObject *object, int algorithm,
+	sexpArena *a)
+{
+	sexpHashCache *c;
+	/* the caches within object are needed to tell when it changes,
+	 * but a tape can't change, or keep them */
+	if (isTapeNode(object))
+		c = objectHashCache(object, a);
+	else
+		c = sexpHashTree(object, 0, a);
+	if (c->digestAlgorithm != algorithm) {
+		sexpHashObject(os, object, algorithm, c->digest);
+		c->digestAlgorithm = algorithm;
+	}
+	return c->digest;
+}
+
+/* hashPrintObject(os, object, algorithm)
+ * Prints the digest of the canonical form of object, hashed with
+ * algorithm, in hexadecimal.
+ */
+void
+hashPrintObject(sexpOutputStream *os, sexpObject *object, int algorithm)
+{
+	uint8_t digest[SEXP_MAXDIGESTSIZE];
+	printDigest(os, digest, sexpHashObject(os, object, algorithm, digest));
+}
+
+/* printDigest(os, digest, n)
+ * Prints the n bytes of digest in lower case hexadecimal, as the usual
+ * hashing tools do.
+ */
+void
+printDigest(sexpOutputStream *os, uint8_t *digest, int n)
+{
+	static const char *digits = "0123456789abcdef";
+	uint8_t chars[2 * SEXP_MAXDIGESTSIZE];
+	int i;
+	for (i = 0; i < n; i++) {
+		chars[2 * i] = digits[digest[i] >> 4];
+		chars[2 * i + 1] = digits[digest[i] & 0x0F];
+	}
+	os->putBytes(os, chars, 2L * n);
+}
@@ -0,0 +1,182 @@
+#include "sexp.h"
+
+/* An index of the objects of an input has a line for each object,
+ * giving its record number (from 1), its offset and its length in
+ * bytes, and its key, if it has one:
+ *	record offset length [key]
+ * The key of a list is its first item, if that is a token, or a
+ * verbatim string that could be one.
+ */
+
+/* newSexpIndex(file)
+ * Creates an index to be written to or read from file.
+ */
+sexpIndex *
+newSexpIndex(FILE *file)
+{
+	sexpIndex *ix;
+	ix = malloc(sizeof (sexpIndex));
+	if (ix == NULL)
+		err(1, "%s", "Can't allocate index");
+	ix->file = file;
+	ix->record = 0;
+	ix->offset = 0;
+	ix->length = 0;
+	ix->key = NULL;
+	ix->line = NULL;
+	ix->lineSize = 0;
+	ix->errorMessage[0] = '\0';
+	return ix;
+}
+
+/* findObjectKey(buffer, start, end, keyLength)
+ * Returns the key of the object from start to end in buffer, and
+ * stores its length in *keyLength, or returns NULL if it has none.
+ */
+uint8_t *
+findObjectKey(uint8_t *buffer, size_t start, size_t end, size_t *keyLength)
+{
+	size_t i = start + 1, keyStart;
+	unsigned long int n = 0;
+	if (start >= end || buffer[start] != '(')
+		return NULL;
+	while (i < end && charClass[buffer[i]] & SEXP_WHITESPACE)
+		i++;
+	if (i >= end || !(charClass[buffer[i]] & SEXP_TOKENCHAR))
+		return NULL;
+	if (charClass[buffer[i]] & SEXP_DECDIGIT) {
+		while (i < end && charClass[buffer[i]] & SEXP_DECDIGIT
+			&& n < 1000000000)
+			n = 10 * n + (buffer[i++] - '0');
+		if (i >= end || buffer[i++] != ':' || n == 0 || n > end - i
+			|| charClass[buffer[i]] & SEXP_DECDIGIT)
+			return NULL;
+		end = i + n;
+	}
+	for (keyStart = i; i < end && charClass[buffer[i]] & SEXP_TOKENCHAR;)
+		i++;
+	if (i < end && n > 0)
+		return NULL;	/* verbatim, and not a token */
+	*keyLength = i - keyStart;
+	return buffer + keyStart;
+}
+
+/* writeIndexEntries(ix, buffer, length, offset, all)
+ * Writes the index entries of the whole objects at the start of
+ * buffer, which is at offset in the input, for readObjects().
+ * Returns the number of bytes used, leaving an incomplete object at
+ * the end for it to report.
+ */
+size_t
+writeIndexEntries(sexpIndex *ix, uint8_t *buffer, size_t length,
+	long int offset, int all)
+{
+	size_t start, end = 0, keyLength, tokenEnd;
+	long int objectEnd;
+	uint8_t *key;
+	for (;;) {
+		objectEnd = findObjectEnd(buffer, length, end, &start);
+		if (objectEnd < 0 && all && start < length) {
+			/* only a token can end with the input */
+			for (tokenEnd = start; tokenEnd < length
+				&& charClass[buffer[tokenEnd]] & SEXP_TOKENCHAR; tokenEnd++)
+				;
+			if (tokenEnd == length
+				&& !(charClass[buffer[start]] & SEXP_DECDIGIT))
+				objectEnd = length;
+		}
+		if (objectEnd < 0)
+			break;
+		fprintf(ix->file, "%ld %ld %ld", ++ix->record,
+			offset + (long int) start, objectEnd - (long int) start);
+		key = findObjectKey(buffer, start, objectEnd, &keyLength);
+		if (key != NULL) {
+			putc(' ', ix->file);
+			fwrite(key, 1, keyLength, ix->file);
+		}
+		putc('\n', ix->file);
+		end = objectEnd;
+	}
+	fflush(ix->file);
+	return end;
+}
+
+/* readIndexEntry(ix)
+ * Reads the next entry of the index into ix.  Returns false at the end
+ * of the index, or at an entry that isn't one, saying so in
+ * ix->errorMessage.
+ */
+int
+readIndexEntry(sexpIndex *ix)
+{
+	ssize_t n;
+	int used = 0;
+	ix->errorMessage[0] = '\0';
+	n = getline(&ix->line, &ix->lineSize, ix->file);
+	if (n < 0)
+		return false;
+	if (ix->line[n - 1] == '\n')
+		ix->line[--n] = '\0';
+	if (sscanf(ix->line, "%ld %ld %ld%n", &ix->record, &ix->offset,
+			&ix->length, &used) != 3 || ix->offset < 0 || ix->length < 0) {
+		snprintf(ix->errorMessage, sizeof (ix->errorMessage),
+			"Bad index entry: %s", ix->line);
+		return false;
+	}
+	ix->key = ix->line + used;
+	if (*ix->key == ' ')
+		ix->key++;
+	return true;
+}
+
+/* seekIndexRecord(ix, record)
+ * Positions the index so that the next entry read is that of record,
+ * searching the sorted entries by halves.  Returns false if there is
+ * no such record, or the index can't be searched, saying which in
+ * ix->errorMessage.
+ */
+int
+seekIndexRecord(sexpIndex *ix, long int record)
+{
+	long int low = 0, high, middle, found;
+	int c, entry;
+	if (fseek(ix->file, 0, SEEK_END) != 0 || (high = ftell(ix->file)) < 0) {
+		snprintf(ix->errorMessage, sizeof (ix->errorMessage),
+			"Can't search index: %s", strerror(errno));
+		return false;
+	}
+	/* the first entry after low, if low > 0, is of an earlier record,
+	 * and the first entry after high, if any, is not */
+	while (high - low > 1) {
+		middle = low + (high - low) / 2;
+		fseek(ix->file, middle, SEEK_SET);
+		while ((c = getc(ix->file)) != EOF && c != '\n')
+			;
+		if (c == EOF || !readIndexEntry(ix)) {
+			if (ix->errorMessage[0] != '\0')
+				return false;
+			high = middle;
+		} else if (ix->record >= record)
+			high = middle;
+		else
+			low = middle;
+	}
+	/* the entries from there on are read until one reaches record */
+	fseek(ix->file, low, SEEK_SET);
+	if (low > 0)
+		while ((c = getc(ix->file)) != EOF && c != '\n')
+			;
+	do {
+		found = ftell(ix->file);
+		entry = readIndexEntry(ix);
+	} while (entry && ix->record < record);
+	if (!entry && ix->errorMessage[0] != '\0')
+		return false;
+	if (!entry || ix->record != record) {
+		snprintf(ix->errorMessage, sizeof (ix->errorMessage),
+			"No record %ld in index.", record);
+		return false;
+	}
+	fseek(ix->file, found, SEEK_SET);
+	return true;
+}
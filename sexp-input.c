@@ -4,62 +4,67 @@
 /* CHARACTER ROUTINES AND DEFINITIONS */
 /**************************************/
 
-char upper[256];		/* upper[c] is upper case version of c */
-char decdigit[256];		/* decdigit[c] is nonzero if c is a dec digit */
-char decvalue[256];		/* decvalue[c] is value of c as dec digit */
-char hexdigit[256];		/* hexdigit[c] is nonzero if c is a hex digit */
-char hexvalue[256];		/* hexvalue[c] is value of c as a hex digit */
-char base64digit[256];	/* base64char[c] is nonzero if c is base64 digit */
-char base64value[256];	/* base64value[c] is value of c as base64 digit */
-char tokenchar[256];	/* tokenchar[c] is true if c can be in a token */
-char alpha[256];		/* alpha[c] is true if c is alphabetic /A-Za-z/ */
+/* charClass[c] has the bits of the classes c belongs to.  The table is
+ * filled in by the preprocessor, so it is constant and needs no
+ * initialization: T256(f) lists f(c) for every c from 0 to 255. */
+#define T4(f, c) f(c), f((c) + 1), f((c) + 2), f((c) + 3)
+#define T16(f, c) T4(f, c), T4(f, (c) + 4), T4(f, (c) + 8), T4(f, (c) + 12)
+#define T64(f, c) \
+	T16(f, c), T16(f, (c) + 16), T16(f, (c) + 32), T16(f, (c) + 48)
+#define T256(f) T64(f, 0), T64(f, 64), T64(f, 128), T64(f, 192)
+
+#define ALPHA(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+#define DECDIGIT(c) ((c) >= '0' && (c) <= '9')
+#define HEXDIGIT(c) \
+	(DECDIGIT(c) || ((c) >= 'a' && (c) <= 'f') || ((c) >= 'A' && (c) <= 'F'))
+#define CLASSES(c) ( \
+	((c) == ' ' || ((c) >= '\t' && (c) <= '\r') ? SEXP_WHITESPACE : 0) \
+	| (DECDIGIT(c) ? SEXP_DECDIGIT : 0) \
+	| (HEXDIGIT(c) ? SEXP_HEXDIGIT : 0) \
+	| (ALPHA(c) || DECDIGIT(c) || (c) == '+' || (c) == '/' \
+		? SEXP_BASE64DIGIT : 0) \
+	| (ALPHA(c) || DECDIGIT(c) || (c) == '-' || (c) == '.' || (c) == '/' \
+		|| (c) == '_' || (c) == ':' || (c) == '*' || (c) == '+' \
+		|| (c) == '=' ? SEXP_TOKENCHAR : 0) \
+	| (ALPHA(c) ? SEXP_ALPHA : 0) \
+	| ((c) == '(' || (c) == ')' || (c) == '"' || (c) == '|' || (c) == '#' \
+		|| (c) == '{' || (c) == '[' || DECDIGIT(c) ? SEXP_STRUCTURAL : 0))
+
+const uint8_t charClass[256] = { T256(CLASSES) };
 
 /* initializeCharacterTables()
- * Initializes all of the above arrays
+ * Nothing to do: the table above is constant.
  */
 void
 initializeCharacterTables()
 {
-	int i;
-	for (i = 0; i < 256; i++)
-		upper[i] = i;
-	for (i = 'a'; i <= 'z'; i++)
-		upper[i] = i - 'a' + 'A';
-	for (i = 0; i <= 255; i++)
-		alpha[i] = decdigit[i] = base64digit[i] = false;
-	for (i = '0'; i <= '9'; i++) {
-		base64digit[i] = hexdigit[i] = decdigit[i] = true;
-		decvalue[i] = hexvalue[i] = i - '0';
-		base64value[i] = (i - '0') + 52;
-	}
-	for (i = 'a'; i <= 'f'; i++) {
-		hexdigit[i] = hexdigit[upper[i]] = true;
-		hexvalue[i] = hexvalue[upper[i]] = i - 'a' + 10;
-	}
-	for (i = 'a'; i <= 'z'; i++) {
-		base64digit[i] = base64digit[upper[i]] = true;
-		alpha[i] = alpha[upper[i]] = true;
-		base64value[i] = i - 'a' + 26;
-		base64value[upper[i]] = i - 'a';
-	}
-	base64digit['+'] = base64digit['/'] = true;
-	base64value['+'] = 62;
-	base64value['/'] = 63;
-	base64value['='] = 0;
-	for (i = 0; i < 255; i++)
-		tokenchar[i] = false;
-	for (i = 'a'; i <= 'z'; i++)
-		tokenchar[i] = tokenchar[upper[i]] = true;
-	for (i = '0'; i <= '9'; i++)
-		tokenchar[i] = true;
-	tokenchar['-'] = true;
-	tokenchar['.'] = true;
-	tokenchar['/'] = true;
-	tokenchar['_'] = true;
-	tokenchar[':'] = true;
-	tokenchar['*'] = true;
-	tokenchar['+'] = true;
-	tokenchar['='] = true;
+}
+
+/* isWhiteSpace(c)
+ * Returns true if c is white space: blank, \t, \n, \v, \f or \r
+ */
+int
+isWhiteSpace(int c)
+{
+	return CHARCLASS(c) & SEXP_WHITESPACE;
+}
+
+/* isDecDigit(c)
+ * Returns true if c is a decimal digit
+ */
+int
+isDecDigit(int c)
+{
+	return CHARCLASS(c) & SEXP_DECDIGIT;
+}
+
+/* isHexDigit(c)
+ * Returns true if c is a hexadecimal digit
+ */
+int
+isHexDigit(int c)
+{
+	return CHARCLASS(c) & SEXP_HEXDIGIT;
 }
 
 /* isBase64Digit(c)
@@ -68,7 +73,7 @@ initializeCharacterTables()
 int
 isBase64Digit(int c)
 {
-	return (c >= 0 && c <= 255) && base64digit[c];
+	return CHARCLASS(c) & SEXP_BASE64DIGIT;
 }
 
 /* isTokenChar(c)
@@ -77,7 +82,58 @@ isBase64Digit(int c)
 int
 isTokenChar(int c)
 {
-	return (c >= 0 && c <= 255) && tokenchar[c];
+	return CHARCLASS(c) & SEXP_TOKENCHAR;
+}
+
+/* isAlpha(c)
+ * Returns true if c is alphabetic /A-Za-z/
+ */
+int
+isAlpha(int c)
+{
+	return CHARCLASS(c) & SEXP_ALPHA;
+}
+
+/**********/
+/* ERRORS */
+/**********/
+
+/* Errors in the input go through sexpError().  A stream with no error
+ * handler, like the one sexp uses, reports them with err(), ending the
+ * program.  Under sexpParseObject() they are recorded in the stream
+ * instead, and the parse is abandoned with longjmp().
+ */
+
+/* sexpError(is, code, format, ...)
+ * Reports an error of the given kind at the current input position.
+ */
+void
+sexpError(sexpInputStream *is, int code, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	if (is->onError == NULL)
+		verr(1, format, ap);
+	vsnprintf(is->errorMessage, sizeof (is->errorMessage), format, ap);
+	va_end(ap);
+	is->error = code;
+	is->errorOffset = is->count;
+	longjmp(*is->onError, code);
+}
+
+/* sexpWarning(is, format, ...)
+ * Reports a problem with the input that doesn't stop it being read.
+ * Warnings are only printed when errors would be.
+ */
+void
+sexpWarning(sexpInputStream *is, const char *format, ...)
+{
+	va_list ap;
+	if (is->onError != NULL)
+		return;
+	va_start(ap, format);
+	vwarn(format, ap);
+	va_end(ap);
 }
 
 /**********************/
@@ -94,9 +150,45 @@ changeInputByteSize(sexpInputStream *is, int newByteSize)
 	is->bits = 0;
 }
 
+/* fillInputBuffer(is)
+ * Reads the next block of input into is->buffer.
+ * Returns the number of bytes now available, or 0 at end of input.
+ * A mapped file is already entirely in the buffer.
+ */
+size_t
+fillInputBuffer(sexpInputStream *is)
+{
+	ssize_t n;
+	int phase;
+	if (is->mapped)
+		return 0;
+	SEXP_COUNT(is->stats, inputBase, is->bufferLength);
+	phase = SEXP_ENTER(is->stats, SEXP_PHASE_READ);
+	do
+		n = read(fileno(is->inputFile), is->buffer, INPUTBUFFERSIZE);
+	while (n < 0 && errno == EINTR);
+	SEXP_LEAVE(is->stats, phase);
+	if (n < 0)
+		sexpError(is, SEXP_ERR_INPUT, "%s", "Can't read input");
+	is->bufferLength = n;
+	is->position = 0;
+	return n;
+}
+
+/* nextInputByte(is)
+ * Returns the next raw byte of input, or EOF.
+ */
+int
+nextInputByte(sexpInputStream *is)
+{
+	if (is->position < is->bufferLength || fillInputBuffer(is) > 0)
+		return is->buffer[is->position++];
+	return EOF;
+}
+
 /* getChar(is)
  * This is one possible character input routine for an input stream.
- * (This version uses the standard input stream.)
+ * (This version reads blocks of input into the stream's buffer.)
  * getChar places next 8-bit character into is->nextChar.
  * It also updates the count of number of 8-bit characters read.
  * The value EOF is obtained when no more input is available.  
@@ -110,33 +202,38 @@ getChar(sexpInputStream *is)
 		is->byteSize = 8;
 		return;
 	}
-	while ((c = is->nextChar = fgetc(is->inputFile)) != EOF) {
+	if (is->byteSize == 8) {
+		/* plain 8-bit input comes straight out of the buffer */
+		if ((is->nextChar = nextInputByte(is)) != EOF)
+			is->count++;
+		return;
+	}
+	while ((c = is->nextChar = nextInputByte(is)) != EOF) {
 		/* End of region reached; return terminating character, after
 			checking for unused bits */
 		if ((is->byteSize == 6 && (c == '|' || c == '}'))
 			|| (is->byteSize == 4 && (c == '#')))
 		{
 			if (is->nBits > 0 && (((1 << is->nBits) - 1) & is->bits) != 0)
-				warn("%d-bit region ended with %d unused bits left-over",
+				sexpWarning(is,
+					"%d-bit region ended with %d unused bits left-over",
 					is->byteSize, is->nBits);
 			changeInputByteSize(is, 8);
 			return;
 		/* ignore whitespace in hex and Base64 regions */
-		} else if (is->byteSize != 8 && isspace(c));
+		} else if (isWhiteSpace(c));
 		/* ignore equals sign in Base64 regions */
 		else if (is->byteSize == 6 && c == '=');
-		else if (is->byteSize == 8) {
-			is->count++;
-			return;
-		} else if (is->byteSize < 8) {
+		else {
 			is->bits = is->bits << is->byteSize;
 			is->nBits += is->byteSize;
 			if (is->byteSize == 6 && isBase64Digit(c))
-				is->bits = is->bits | base64value[c];
-			else if (is->byteSize == 4 && isxdigit(c))
-				is->bits = is->bits | hexvalue[c];
+				is->bits = is->bits | base64Values[c];
+			else if (is->byteSize == 4 && isHexDigit(c))
+				is->bits = is->bits | hexValues[c];
 			else
-				err(1, "character %c found in %d-bit coding region",
+				sexpError(is, SEXP_ERR_SYNTAX,
+					"character %c found in %d-bit coding region",
 					(int) is->nextChar, is->byteSize);
 			if (is->nBits >= 8) {
 				is->nextChar = (is->bits >> (is->nBits - 8)) & 0xFF;
@@ -148,6 +245,79 @@ getChar(sexpInputStream *is)
 	}
 }
 
+/* copyInputBytes(is, ss, n)
+ * Appends up to n bytes of plain 8-bit input following is->nextChar
+ * to ss, copying whole runs out of the buffer.  Leaves is->nextChar
+ * alone; returns the number of bytes copied, less than n only at EOF.
+ */
+long int
+copyInputBytes(sexpInputStream *is, sexpSimpleString *ss, long int n)
+{
+	long int copied = 0, run;
+	while (copied < n
+		   && (is->position < is->bufferLength || fillInputBuffer(is) > 0)) {
+		run = is->bufferLength - is->position;
+		if (run > n - copied)
+			run = n - copied;
+		appendBytesToSimpleString(is->buffer + is->position, run, ss);
+		is->position += run;
+		is->count += run;
+		copied += run;
+	}
+	return copied;
+}
+
+/* decodeInputRegion(is, ss)
+ * Called with is->nextChar the character opening a 4-bit or 6-bit
+ * region (of size is->byteSize), decodes the rest of the region
+ * straight out of the buffer, a block at a time, appending the bytes
+ * to ss.  Leaves the stream as getChar would after the last of them:
+ * at the character ending the region, back in 8-bit mode, or at EOF.
+ */
+void
+decodeInputRegion(sexpInputStream *is, sexpSimpleString *ss)
+{
+	uint8_t out[DECODEBUFFERSIZE * 3 / 4 + 32];
+	long int n, used, decoded;
+	int c, phase = SEXP_ENTER(is->stats, SEXP_PHASE_DECODE);
+	while (is->position < is->bufferLength || fillInputBuffer(is) > 0) {
+		n = is->bufferLength - is->position;
+		if (n > DECODEBUFFERSIZE)
+			n = DECODEBUFFERSIZE;
+		if (is->byteSize == 6)
+			used = decodeBase64(out, &decoded, is->buffer + is->position, n,
+				&is->bits, &is->nBits);
+		else
+			used = decodeHex(out, &decoded, is->buffer + is->position, n,
+				&is->bits, &is->nBits);
+		appendBytesToSimpleString(out, decoded, ss);
+		is->position += used;
+		is->count += decoded;
+		/* these bytes are counted in their region, not as 8-bit ones */
+		SEXP_COUNT(is->stats, bytesIn[SEXP_REGION(is->byteSize)], used);
+		SEXP_COUNT(is->stats, bytesIn[SEXP_REGION(8)], -used);
+		if (used == n)
+			continue;
+		/* stopped at a character that is not a digit */
+		c = is->nextChar = is->buffer[is->position++];
+		if ((is->byteSize == 6 && (c == '|' || c == '}'))
+			|| (is->byteSize == 4 && (c == '#'))) {
+			if (is->nBits > 0 && (((1 << is->nBits) - 1) & is->bits) != 0)
+				sexpWarning(is,
+					"%d-bit region ended with %d unused bits left-over",
+					is->byteSize, is->nBits);
+			changeInputByteSize(is, 8);
+			SEXP_LEAVE(is->stats, phase);
+			return;
+		}
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"character %c found in %d-bit coding region",
+			(int) is->nextChar, is->byteSize);
+	}
+	is->nextChar = EOF;
+	SEXP_LEAVE(is->stats, phase);
+}
+
 /* newSexpInputStream()
  * Creates and initializes a new sexpInputStream object.
  * (Prefixes stream with one blank and initializes it,
@@ -165,9 +335,136 @@ newSexpInputStream()
 	is->bits = 0;
 	is->nBits = 0;
 	is->inputFile = stdin;
+	is->buffer = malloc(INPUTBUFFERSIZE);
+	is->bufferLength = 0;
+	is->position = 0;
+	is->mapped = false;
+	is->arena = newSexpArena();
+	is->builder = newTreeBuilder(is->arena);
+	is->tapeBuilder = NULL;
+	is->tapes = false;
+	is->lazy = false;
+	is->extents = NULL;
+	is->extentsSize = is->extentsCount = 0;
+	is->nextExtent = NULL;
+	is->extentsLeft = 0;
+	is->atoms = NULL;
+	is->snapshot = false;
+	is->snapshotStrings = NULL;
+	is->snapshotStringsSize = is->snapshotStringsCount = 0;
+	is->depth = 0;
+	is->maxDepth = -1;
+	is->stats = NULL;
+	is->mapLength = 0;
+	is->onError = NULL;
+	is->error = SEXP_OK;
+	is->errorOffset = 0;
+	is->errorMessage[0] = '\0';
+	return is;
+}
+
+/* newSexpMemoryInputStream(data, length)
+ * Creates a new sexpInputStream reading the length bytes at data.
+ * The bytes must stay put while the stream, and objects read from it,
+ * are in use, since strings may be borrowed from them.
+ */
+sexpInputStream *
+newSexpMemoryInputStream(uint8_t *data, size_t length)
+{
+	sexpInputStream *is;
+	is = newSexpInputStream();
+	free(is->buffer);
+	is->inputFile = NULL;
+	resetSexpMemoryInputStream(is, data, length);
 	return is;
 }
 
+/* resetSexpMemoryInputStream(is, data, length)
+ * Makes memory input stream is read the length bytes at data instead,
+ * from the start and with no error.  Objects read before are released.
+ */
+void
+resetSexpMemoryInputStream(sexpInputStream *is, uint8_t *data, size_t length)
+{
+	releaseSexpArena(is->arena);
+	is->buffer = data;
+	is->bufferLength = length;
+	is->position = 0;
+	is->mapped = true;
+	is->nextChar = ' ';
+	is->count = -1;
+	is->depth = 0;
+	is->nextExtent = NULL;
+	is->snapshotStringsCount = 0;
+	is->error = SEXP_OK;
+	is->errorMessage[0] = '\0';
+	changeInputByteSize(is, 8);
+}
+
+/* openSexpInputFile(is, filename)
+ * Makes is read from the named file instead of stdin.
+ * A regular file is mapped into memory whole, rather than read
+ * block by block.  Returns false if the file can't be opened.
+ */
+int
+openSexpInputFile(sexpInputStream *is, char *filename)
+{
+	struct stat st;
+	void *map;
+	is->inputFile = fopen(filename, "r");
+	if (is->inputFile == NULL)
+		return false;
+	if (fstat(fileno(is->inputFile), &st) == 0 && S_ISREG(st.st_mode)
+		&& st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			fileno(is->inputFile), 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+			free(is->buffer);
+			is->buffer = map;
+			is->bufferLength = st.st_size;
+			is->position = 0;
+			is->mapped = true;
+			is->mapLength = st.st_size;
+		}
+	}
+	return true;
+}
+
+/* freeSexpInputStream(is)
+ * Closes the input of is, and frees is and everything read from it.
+ */
+void
+freeSexpInputStream(sexpInputStream *is)
+{
+	sexpTreeBuilder *tb = is->builder->data;
+	sexpTapeBuilder *tape;
+	if (is->mapLength > 0)
+		munmap(is->buffer, is->mapLength);
+	else if (!is->mapped)
+		free(is->buffer);
+	if (is->inputFile != NULL && is->inputFile != stdin)
+		fclose(is->inputFile);
+	freeSexpArena(is->arena);
+	if (is->atoms != NULL)
+		freeSexpAtomTable(is->atoms);
+	free(is->extents);
+	free(is->snapshotStrings);
+	free(tb->stack);
+	free(tb);
+	free(is->builder);
+	if (is->tapeBuilder != NULL) {
+		tape = is->tapeBuilder->data;
+		free(tape->nodes);
+		free(tape->bytes);
+		free(tape->stack);
+		free(tape);
+		freeSexpArena(is->tapeBuilder->arena);
+		free(is->tapeBuilder);
+	}
+	free(is);
+}
+
 /*****************************************/
 /* INPUT (SCANNING AND PARSING) ROUTINES */
 /*****************************************/
@@ -178,8 +475,18 @@ newSexpInputStream()
 void
 skipWhiteSpace(sexpInputStream *is)
 {
-	while (isspace(is->nextChar))
+	size_t start;
+	while (isWhiteSpace(is->nextChar)) {
+		if (is->byteSize == 8 && is->getChar == getChar) {
+			/* skip the rest of the run in the buffer at once */
+			start = is->position;
+			while (is->position < is->bufferLength
+				   && charClass[is->buffer[is->position]] & SEXP_WHITESPACE)
+				is->position++;
+			is->count += is->position - start;
+		}
 		is->getChar(is);
+	}
 }
 
 /* skipChar(is, c)
@@ -192,7 +499,8 @@ skipChar(sexpInputStream *is, int c)
 	if (is->nextChar == c)
 		is->getChar(is);
 	else
-		err(1, "character %x (hex) found where %c (char) expected",
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"character %x (hex) found where %c (char) expected",
 			(int) is->nextChar, (int) c);
 }
 
@@ -202,9 +510,20 @@ skipChar(sexpInputStream *is, int c)
 void
 scanToken(sexpInputStream *is, sexpSimpleString *ss)
 {
+	size_t start;
 	skipWhiteSpace(is);
 	while (isTokenChar(is->nextChar)) {
 		appendCharToSimpleString(is->nextChar, ss);
+		if (is->byteSize == 8 && is->getChar == getChar) {
+			/* copy the rest of the run in the buffer at once */
+			start = is->position;
+			while (is->position < is->bufferLength
+				   && charClass[is->buffer[is->position]] & SEXP_TOKENCHAR)
+				is->position++;
+			appendBytesToSimpleString(is->buffer + start,
+				is->position - start, ss);
+			is->count += is->position - start;
+		}
 		is->getChar(is);
 	}
 	return;
@@ -217,10 +536,15 @@ scanToken(sexpInputStream *is, sexpSimpleString *ss)
 sexpObject *
 scanToEOF(sexpInputStream *is)
 {
-	sexpSimpleString *ss = newSimpleString();
-	sexpString *s = newSexpString();
+	sexpSimpleString *ss = newSimpleString(is->arena);
+	sexpString *s = newSexpString(is->arena);
 	setSexpStringString(s, ss);
 	skipWhiteSpace(is);
+	if (is->nextChar != EOF && is->byteSize == 8 && is->getChar == getChar) {
+		appendCharToSimpleString(is->nextChar, ss);
+		copyInputBytes(is, ss, LONG_MAX);
+		is->getChar(is);
+	}
 	while (is->nextChar != EOF) {
 		appendCharToSimpleString(is->nextChar, ss);
 		is->getChar(is);
@@ -236,17 +560,19 @@ scanDecimal(sexpInputStream *is)
 {
 	unsigned long int value = 0L;
 	int i = 0;
-	while (isdigit(is->nextChar)) {
-		value = value * 10 + decvalue[is->nextChar];
+	while (isDecDigit(is->nextChar)) {
+		value = value * 10 + (is->nextChar - '0');
 		is->getChar(is);
 		if (i++ > 8)
-			err(1, "Decimal number %d... too long.", (int) value);
+			sexpError(is, SEXP_ERR_SYNTAX,
+				"Decimal number %d... too long.", (int) value);
 	}
 	return value;
 }
 
 /* scanVerbatimString(is, ss, length)
  * Reads verbatim string of given length into simple string ss.
+ * When reading a mapped file, ss just borrows the string from the map.
  */
 void
 scanVerbatimString(sexpInputStream *is, sexpSimpleString *ss, long int length)
@@ -255,8 +581,26 @@ scanVerbatimString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 	skipWhiteSpace(is);
 	skipChar(is, ':');
 	if (length == -1L)	/* no length was specified */
-		err(1, "%s", "Verbatim string had no declared length.");
-	for (i = 0; i < length; i++) {
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"%s", "Verbatim string had no declared length.");
+	if (length > 0 && is->nextChar != EOF && is->byteSize == 8
+		&& is->getChar == getChar && is->mapped && simpleStringLength(ss) == 0
+		&& is->bufferLength - (is->position - 1) >= (size_t) length) {
+		/* the whole string is in the mapped file: point ss at it */
+		borrowSimpleString(ss, is->buffer + is->position - 1, length);
+		is->position += length - 1;
+		is->count += length - 1;
+		is->getChar(is);
+		return;
+	}
+	if (length > 0 && is->nextChar != EOF && is->byteSize == 8
+		&& is->getChar == getChar) {
+		/* length is known: copy the string out of the buffer in bulk */
+		appendCharToSimpleString(is->nextChar, ss);
+		i = 1 + copyInputBytes(is, ss, length - 1);
+		is->getChar(is);
+	}
+	for (; i < length; i++) {
 		appendCharToSimpleString(is->nextChar, ss);
 		is->getChar(is);
 	}
@@ -279,7 +623,8 @@ scanQuotedString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 				skipChar(is, '\"');
 				return;
 			} else
-				err(1, "Quoted string ended too early. Declared length was %d",
+				sexpError(is, SEXP_ERR_SYNTAX,
+					"Quoted string ended too early. Declared length was %d",
 					(int) length);
 		} else if (is->nextChar == '\\') {	/* handle C escape sequence */
 			is->getChar(is);
@@ -313,10 +658,12 @@ scanQuotedString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 							c = is->nextChar;
 						}
 					} else
-						err(1, "Octal character \\%o... too short.", val);
+						sexpError(is, SEXP_ERR_SYNTAX,
+							"Octal character \\%o... too short.", val);
 				}
 				if (val > 255)
-					err(1, "Octal character \\%o... too big.", val);
+					sexpError(is, SEXP_ERR_SYNTAX,
+						"Octal character \\%o... too big.", val);
 				appendCharToSimpleString(val, ss);
 			} else if (c == 'x') {	/* hexadecimal number */
 				int j, val;
@@ -324,14 +671,15 @@ scanQuotedString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 				is->getChar(is);
 				c = is->nextChar;
 				for (j = 0; j < 2; j++) {
-					if (isxdigit(c)) {
-						val = (val << 4) | hexvalue[c];
+					if (isHexDigit(c)) {
+						val = (val << 4) | hexValues[c];
 						if (j < 1) {
 							is->getChar(is);
 							c = is->nextChar;
 						}
 					} else
-						err(1, "Hex character \\x%x... too short.", val);
+						sexpError(is, SEXP_ERR_SYNTAX,
+							"Hex character \\x%x... too short.", val);
 				}
 				appendCharToSimpleString(val, ss);
 			} else if (c == '\n') {	/* ignore backslash line feed */
@@ -345,7 +693,7 @@ scanQuotedString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 				if (is->nextChar != '\n')
 					goto gotnextchar;
 			} else
-				warn("Escape character \\%c... unknown.", c);
+				sexpWarning(is, "Escape character \\%c... unknown.", c);
 		}	/* end of handling escape sequence */
 		else
 			appendCharToSimpleString(is->nextChar, ss);
@@ -363,14 +711,18 @@ void
 scanHexString(sexpInputStream *is, sexpSimpleString *ss, long int length)
 {
 	changeInputByteSize(is, 4);
-	skipChar(is, '#');
+	if (is->nextChar == '#' && is->getChar == getChar)
+		decodeInputRegion(is, ss);
+	else
+		skipChar(is, '#');
 	while (is->nextChar != EOF && (is->nextChar != '#' || is->byteSize == 4)) {
 		appendCharToSimpleString(is->nextChar, ss);
 		is->getChar(is);
 	}
 	skipChar(is, '#');
 	if (simpleStringLength(ss) != length && length >= 0)
-		warn("Hex string has length %d different than declared length %d",
+		sexpWarning(is,
+			"Hex string has length %d different than declared length %d",
 			(int) simpleStringLength(ss), (int) length);
 }
 
@@ -382,41 +734,88 @@ void
 scanBase64String(sexpInputStream *is, sexpSimpleString *ss, long int length)
 {
 	changeInputByteSize(is, 6);
-	skipChar(is, '|');
+	if (is->nextChar == '|' && is->getChar == getChar)
+		decodeInputRegion(is, ss);
+	else
+		skipChar(is, '|');
 	while (is->nextChar != EOF && (is->nextChar != '|' || is->byteSize == 6)) {
 		appendCharToSimpleString(is->nextChar, ss);
 		is->getChar(is);
 	}
 	skipChar(is, '|');
 	if (simpleStringLength(ss) != length && length >= 0)
-		warn("Base64 string has length %d different than declared length %d",
+		sexpWarning(is,
+			"Base64 string has length %d different than declared length %d",
 			(int) simpleStringLength(ss), (int) length);
 }
 
+/* scanAtom(is)
+ * Reads a token, or a verbatim string, lying whole in the input buffer
+ * as an atom of is->atoms, without copying it out first.  Returns NULL,
+ * having read nothing, if the next string is not such a one, or can't
+ * be an atom.
+ */
+sexpSimpleString *
+scanAtom(sexpInputStream *is)
+{
+	size_t start = is->position - 1, end = is->position, length = 0;
+	sexpSimpleString *atom;
+	if (is->byteSize != 8 || is->getChar != getChar
+		|| !isTokenChar(is->nextChar))
+		return NULL;
+	if (isDecDigit(is->nextChar)) {
+		for (end = start; end < is->bufferLength && length <= MAXATOMLENGTH
+			 && charClass[is->buffer[end]] & SEXP_DECDIGIT; end++)
+			length = 10 * length + (is->buffer[end] - '0');
+		if (end >= is->bufferLength || is->buffer[end] != ':'
+			|| length > MAXATOMLENGTH || length > is->bufferLength - end - 1)
+			return NULL;
+		start = end + 1;
+		end = start + length;
+	} else {
+		while (end < is->bufferLength && end - start <= MAXATOMLENGTH
+			   && charClass[is->buffer[end]] & SEXP_TOKENCHAR)
+			end++;
+		/* unless the input is all there, the token may go on past it */
+		if (end == is->bufferLength && !is->mapped)
+			return NULL;
+	}
+	atom = internAtom(is->atoms, is->buffer + start, end - start);
+	if (atom == NULL)
+		return NULL;
+	is->count += end - is->position;
+	is->position = end;
+	is->getChar(is);
+	return atom;
+}
+
 /* scanSimpleString(is)
  * Reads and returns a simple string from the input stream.
  * Determines type of simple string from the initial character, and
  * dispatches to appropriate routine based on that. 
+ * With an atom table, short strings are returned as its atoms.
  */
 sexpSimpleString *
 scanSimpleString(sexpInputStream *is)
 {
 	long int length;
-	sexpSimpleString *ss;
-	ss = newSimpleString();
+	sexpSimpleString *ss, *atom;
 	skipWhiteSpace(is);
+	if (is->atoms != NULL && (atom = scanAtom(is)) != NULL)
+		return atom;
+	ss = newSimpleString(is->arena);
 	/* Note that it is important in the following code to test for token-ness
 	 * before checking the other cases, so that a token may begin with ":",
 	 * which would otherwise be treated as a verbatim string missing a length.
 	 */
-	if (isTokenChar(is->nextChar) && !isdigit(is->nextChar))
+	if (isTokenChar(is->nextChar) && !isDecDigit(is->nextChar))
 		scanToken(is, ss);
-	else if (isdigit(is->nextChar)
+	else if (isDecDigit(is->nextChar)
 			 || is->nextChar == '\"'
 			 || is->nextChar == '#'
 			 || is->nextChar == '|'
 			 || is->nextChar == ':') {
-		if (isdigit(is->nextChar))
+		if (isDecDigit(is->nextChar))
 			length = scanDecimal(is);
 		else
 			length = -1L;
@@ -429,10 +828,14 @@ scanSimpleString(sexpInputStream *is)
 		else if (is->nextChar == ':')
 			scanVerbatimString(is, ss, length);
 	} else
-		err(1, "illegal character at position %d: %d (decimal)",
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"illegal character at position %ld: %d (decimal)",
 			is->count, is->nextChar);
 	if (simpleStringLength(ss) == 0)
-		warn("%s", "Simple string has zero length.");
+		sexpWarning(is, "%s", "Simple string has zero length.");
+	if (is->atoms != NULL && (atom = internAtom(is->atoms,
+			simpleStringString(ss), simpleStringLength(ss))) != NULL)
+		return atom;
 	return ss;
 }
 
@@ -444,7 +847,7 @@ scanString(sexpInputStream *is)
 {
 	sexpString *s;
 	sexpSimpleString *ss;
-	s = newSexpString();
+	s = newSexpString(is->arena);
 	/* scan presentation hint */
 	if (is->nextChar == '[') {
 		skipChar(is, '[');
@@ -460,57 +863,844 @@ scanString(sexpInputStream *is)
 	return s;
 }
 
-/* scanList(is)
- * Read and return a sexpList from the input stream.
+/* scanTransportRegion(is, sink)
+ * Reads the object in the {...} region the input stream is at,
+ * reporting it to sink.  The whole region is decoded first, and the
+ * object is then scanned out of the decoded bytes as though they were
+ * the input, so that regions within it are decoded in their turn.
  */
-sexpList *
-scanList(sexpInputStream *is)
+void
+scanTransportRegion(sexpInputStream *is, sexpEventSink *sink)
 {
-	sexpList *list;
-	sexpObject *object;
-	skipChar(is, '(');
-	skipWhiteSpace(is);
-	list = newSexpList();
-	if (is->nextChar == ')') {
-	/* err(1, "List () with no contents is illegal."); */
-		;	/* OK */
-	} else {
-		object = scanObject(is);
-		sexpAddSexpListObject(list, object);
-	}
-	while (true) {
+	sexpSimpleString *ss;
+	uint8_t *buffer;
+	size_t bufferLength, position;
+	int mapped;
+	long int count;
+	long int bytesIn[SEXP_REGIONS];
+	ss = newSimpleString(is->arena);
+	changeInputByteSize(is, 6);
+	decodeInputRegion(is, ss);
+	count = is->count;
+	/* scan the decoded bytes, followed by the character ending them */
+	is->count -= simpleStringLength(ss);
+	if (is->nextChar != EOF)
+		appendCharToSimpleString(is->nextChar, ss);
+	buffer = is->buffer;
+	bufferLength = is->bufferLength;
+	position = is->position;
+	mapped = is->mapped;
+	is->buffer = simpleStringString(ss);
+	is->bufferLength = simpleStringLength(ss);
+	is->position = 0;
+	is->mapped = true;
+	changeInputByteSize(is, 8);
+	is->nextChar = ' ';
+	is->getChar(is);
+	/* regions within this one were not in the input as such */
+	if (is->stats != NULL)
+		memcpy(bytesIn, is->stats->bytesIn, sizeof bytesIn);
+	scanEvents(is, sink);
+	if (is->stats != NULL)
+		memcpy(is->stats->bytesIn, bytesIn, sizeof bytesIn);
+	if (is->position != is->bufferLength)
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"character %x (hex) found where %c (char) expected",
+			(int) is->nextChar, '}');
+	is->buffer = buffer;
+	is->bufferLength = bufferLength;
+	is->position = position;
+	is->mapped = mapped;
+	is->count = count;
+	skipChar(is, '}');
+}
+
+/* scanEvents(is, sink)
+ * Reads one object from the given input stream, reporting it to sink
+ * piece by piece as it is read, rather than building it.
+ * Open lists are only counted, so nesting costs no stack; the
+ * recursion is for {...} regions, each a third larger than the one it
+ * holds.  No more than is->maxDepth lists may be open at once.
+ */
+void
+scanEvents(sexpInputStream *is, sexpEventSink *sink)
+{
+	sexpArena *arena;
+	sexpString *s;
+	long int base = is->depth;
+	do {
 		skipWhiteSpace(is);
-		if (is->nextChar == ')') {
-			/* We just grabbed last element of list */
+		if (is->nextChar == '{' && is->getChar == getChar)
+			scanTransportRegion(is, sink);
+		else if (is->nextChar == '{') {
+			changeInputByteSize(is, 6);
+			skipChar(is, '{');
+			scanEvents(is, sink);
+			skipChar(is, '}');
+		} else if (is->nextChar == '(') {
+			if (is->maxDepth >= 0 && is->depth >= is->maxDepth)
+				sexpError(is, SEXP_ERR_DEPTH,
+					"Lists nested more than %ld deep.", is->maxDepth);
+			skipChar(is, '(');
+			sink->openList(sink);
+			is->depth++;
+			SEXP_COUNT(is->stats, lists, 1);
+			SEXP_MAX(is->stats, depth, is->depth);
+		} else if (is->nextChar == ')' && is->depth > base) {
 			skipChar(is, ')');
-			closeSexpList(list);
-			return list;
+			sink->closeList(sink);
+			is->depth--;
 		} else {
-			object = scanObject(is);
-			sexpAddSexpListObject(list, object);
+			arena = is->arena;
+			is->arena = sink->arena;
+			s = scanString(is);
+			is->arena = arena;
+			SEXP_COUNT(is->stats, strings, 1);
+			sink->string(sink, s);
 		}
+	} while (is->depth > base);
+}
+
+/*****************/
+/* TREE BUILDING */
+/*****************/
+
+/* scanObject() builds objects with an event sink that keeps the lists
+ * being built on a stack in memory, so deep nesting can't overflow
+ * the C stack. */
+
+/* treeAddObject(tb, object, a)
+ * Adds object, in arena a, to the innermost list being built, or makes
+ * it the finished object if there is none.
+ */
+void
+treeAddObject(sexpTreeBuilder *tb, sexpObject *object, sexpArena *a)
+{
+	sexpBuildFrame *f;
+	if (tb->depth == 0) {
+		tb->object = object;
+		return;
 	}
+	f = &tb->stack[tb->depth - 1];
+	f->tail = sexpAppendSexpListObject(a, f->tail, object);
+}
+
+/* treeOpenList(sink)
+ * Starts a new list within the innermost list being built.
+ */
+void
+treeOpenList(sexpEventSink *sink)
+{
+	sexpTreeBuilder *tb = sink->data;
+	sexpList *list;
+	list = newSexpList(sink->arena);
+	treeAddObject(tb, (sexpObject *) list, sink->arena);
+	if (tb->depth == tb->size) {
+		tb->size = 16 + 2 * tb->size;
+		tb->stack = realloc(tb->stack, tb->size * sizeof (sexpBuildFrame));
+		if (tb->stack == NULL)
+			outOfMemory(sink->arena, "list stack");
+	}
+	tb->stack[tb->depth].list = tb->stack[tb->depth].tail = list;
+	tb->depth++;
+}
+
+/* treeCloseList(sink)
+ * Finishes the innermost list being built.
+ */
+void
+treeCloseList(sexpEventSink *sink)
+{
+	sexpTreeBuilder *tb = sink->data;
+	tb->depth--;
+	closeSexpList(tb->stack[tb->depth].list);
+}
+
+/* treeString(sink, s)
+ * Adds string s to the innermost list being built.
+ */
+void
+treeString(sexpEventSink *sink, sexpString *s)
+{
+	treeAddObject(sink->data, (sexpObject *) s, sink->arena);
+}
+
+/* newTreeBuilder(a)
+ * Creates an event sink that builds objects in arena a.
+ */
+sexpEventSink *
+newTreeBuilder(sexpArena *a)
+{
+	sexpEventSink *sink;
+	sexpTreeBuilder *tb;
+	sink = malloc(sizeof (sexpEventSink));
+	tb = malloc(sizeof (sexpTreeBuilder));
+	tb->stack = NULL;
+	tb->size = 0;
+	tb->depth = 0;
+	tb->object = NULL;
+	sink->openList = treeOpenList;
+	sink->closeList = treeCloseList;
+	sink->string = treeString;
+	sink->arena = a;
+	sink->data = tb;
+	return sink;
+}
+
+/*****************/
+/* TAPE BUILDING */
+/*****************/
+
+/* tapeAddNodes(tb, n)
+ * Appends n nodes to the tape being built, as an item of the
+ * innermost list, and returns the index of the first.
+ */
+static long int
+tapeAddNodes(sexpTapeBuilder *tb, long int n)
+{
+	long int i = tb->count;
+	if (tb->count + n > tb->size) {
+		tb->size = 2 * tb->size + n + 64;
+		tb->nodes = realloc(tb->nodes, tb->size * sizeof (sexpTapeNode));
+		if (tb->nodes == NULL)
+			outOfMemory(tb->objects, "tape");
+	}
+	tb->count += n;
+	if (tb->depth > 0)
+		tb->stack[tb->depth - 1].last = i;
+	return i;
+}
+
+/* tapeAddString(tb, ts, ss)
+ * Fills in ts for the bytes of ss, which are added to the tape being
+ * built.  Its offset is from the start of the bytes until the tape is
+ * complete.
+ */
+static void
+tapeAddString(sexpTapeBuilder *tb, sexpTapeString *ts, sexpSimpleString *ss)
+{
+	size_t n = simpleStringLength(ss);
+	if (tb->bytesCount + n > tb->bytesSize) {
+		tb->bytesSize = 2 * tb->bytesSize + n + 256;
+		tb->bytes = realloc(tb->bytes, tb->bytesSize);
+		if (tb->bytes == NULL)
+			outOfMemory(tb->objects, "tape");
+	}
+	memcpy(tb->bytes + tb->bytesCount, simpleStringString(ss), n);
+	ts->length = -1 - (long int) n;
+	ts->offset = tb->bytesCount;
+	tb->bytesCount += n;
+}
+
+/* tapeFinish(tb)
+ * Moves the tape just completed into one block of tb->objects, with
+ * the bytes after the nodes, and makes the offsets of its strings
+ * relative to themselves.
+ */
+static void
+tapeFinish(sexpTapeBuilder *tb)
+{
+	sexpTapeNode *tape, *node, *end;
+	sexpTapeString *ts;
+	size_t nodesSize = tb->count * sizeof (sexpTapeNode);
+	tape = arenaAllocate(tb->objects, nodesSize + tb->bytesCount);
+	memcpy(tape, tb->nodes, nodesSize);
+	if (tb->bytesCount > 0)
+		memcpy((uint8_t *) tape + nodesSize, tb->bytes, tb->bytesCount);
+	end = tape + tb->count;
+	for (node = tape; node < end; node++)
+		if (objectType(node) == SEXP_TAPE_STRING) {
+			for (ts = (sexpTapeString *) (node + 1);
+				ts < (sexpTapeString *) (node + node->size); ts++)
+				ts->offset += (uint8_t *) end - (uint8_t *) ts;
+			node += node->size - 1;
+		}
+	tb->object = (sexpObject *) tape;
+	tb->count = 0;
+	tb->bytesCount = 0;
+}
+
+/* tapeOpenList(sink)
+ * Starts a new list within the innermost list being built.
+ */
+void
+tapeOpenList(sexpEventSink *sink)
+{
+	sexpTapeBuilder *tb = sink->data;
+	long int i;
+	i = tapeAddNodes(tb, 1);
+	tb->nodes[i].type = SEXP_TAPE_LIST;
+	if (tb->depth == tb->stackSize) {
+		tb->stackSize = 16 + 2 * tb->stackSize;
+		tb->stack = realloc(tb->stack, tb->stackSize * sizeof (sexpTapeFrame));
+		if (tb->stack == NULL)
+			outOfMemory(tb->objects, "list stack");
+	}
+	tb->stack[tb->depth].list = i;
+	tb->stack[tb->depth].last = -1;
+	tb->depth++;
+}
+
+/* tapeCloseList(sink)
+ * Finishes the innermost list being built: it now knows its size, and
+ * its last item is marked.
+ */
+void
+tapeCloseList(sexpEventSink *sink)
+{
+	sexpTapeBuilder *tb = sink->data;
+	sexpTapeFrame *f = &tb->stack[--tb->depth];
+	tb->nodes[f->list].size = tb->count - f->list;
+	if (f->last >= 0)
+		tb->nodes[f->last].type |= SEXP_TAPE_LAST;
+	if (tb->depth == 0)
+		tapeFinish(tb);
+}
+
+/* tapeString(sink, s)
+ * Adds string s to the innermost list being built.  Its bytes are
+ * copied, so s is no longer needed.
+ */
+void
+tapeString(sexpEventSink *sink, sexpString *s)
+{
+	sexpTapeBuilder *tb = sink->data;
+	sexpSimpleString *ph = sexpStringPresentationHint(s);
+	long int i, n = ph == NULL ? 3 : 5;
+	i = tapeAddNodes(tb, n);
+	tb->nodes[i].type = SEXP_TAPE_STRING;
+	tb->nodes[i].size = n;
+	tapeAddString(tb, (sexpTapeString *) &tb->nodes[i + 1], sexpStringString(s));
+	if (ph != NULL)
+		tapeAddString(tb, (sexpTapeString *) &tb->nodes[i + 3], ph);
+	releaseSexpArena(sink->arena);
+	if (tb->depth == 0)
+		tapeFinish(tb);
+}
+
+/* newTapeBuilder(a)
+ * Creates an event sink that builds objects as tapes in arena a.
+ */
+sexpEventSink *
+newTapeBuilder(sexpArena *a)
+{
+	sexpEventSink *sink;
+	sexpTapeBuilder *tb;
+	sink = malloc(sizeof (sexpEventSink));
+	tb = malloc(sizeof (sexpTapeBuilder));
+	if (sink == NULL || tb == NULL)
+		outOfMemory(a, "tape builder");
+	tb->nodes = NULL;
+	tb->size = tb->count = 0;
+	tb->bytes = NULL;
+	tb->bytesSize = tb->bytesCount = 0;
+	tb->stack = NULL;
+	tb->stackSize = tb->depth = 0;
+	tb->objects = a;
+	tb->object = NULL;
+	sink->openList = tapeOpenList;
+	sink->closeList = tapeCloseList;
+	sink->string = tapeString;
+	sink->arena = newSexpArena();
+	sink->data = tb;
+	return sink;
+}
+
+/* tapeSink(is)
+ * Returns the tape builder of the input stream, ready to build a tape.
+ */
+sexpEventSink *
+tapeSink(sexpInputStream *is)
+{
+	sexpTapeBuilder *tb;
+	if (is->tapeBuilder == NULL)
+		is->tapeBuilder = newTapeBuilder(is->arena);
+	tb = is->tapeBuilder->data;
+	tb->depth = 0;
+	tb->count = 0;
+	tb->bytesCount = 0;
+	is->tapeBuilder->arena->onError = is->arena->onError;
+	return is->tapeBuilder;
+}
+
+/* scanTape(is)
+ * Reads a sexpObject from the given input stream as a tape.
+ */
+sexpObject *
+scanTape(sexpInputStream *is)
+{
+	sexpEventSink *sink = tapeSink(is);
+	scanEvents(is, sink);
+	return ((sexpTapeBuilder *) sink->data)->object;
+}
+
+/**************/
+/* LAZY LISTS */
+/**************/
+
+/* With is->lazy set, scanObject() leaves a list in mapped input to be
+ * scanned later: findObjectEnd() finds where it ends, and its items are
+ * only scanned when sexpListIter() first wants them, the lists among
+ * them being left for later in turn.  Picking one item out of a large
+ * object scans just the lists on the way to it.  The extents of all the
+ * lists within a list are kept as it is measured, so that those left
+ * for later as its items are scanned need not be measured again, and
+ * no byte is looked at more than twice however deep the nesting. */
+
+/* newLazyList(is)
+ * Returns a list to be scanned later for the list the input stream is
+ * at, and moves past it.  Returns NULL if that can't be done: the input
+ * isn't mapped, or the list doesn't end within it.
+ */
+sexpObject *
+newLazyList(sexpInputStream *is)
+{
+	sexpLazyList *lazy;
+	sexpListExtent *extent = is->nextExtent;
+	size_t start = is->position - 1;
+	long int end;
+	if (!is->mapped || is->byteSize != 8 || is->getChar != getChar
+		|| is->nextChar != '(')
+		return NULL;
+	/* a list within a lazy list was measured along with it, unless the
+	 * extents have gone astray, as they may in input not well formed */
+	if (extent != NULL && is->extentsLeft > 0
+		&& is->extentsLeft > extent->lists
+		&& extent->length <= is->bufferLength - start
+		&& is->buffer[start + extent->length - 1] == ')') {
+		end = start + extent->length;
+		is->nextExtent += 1 + extent->lists;
+		is->extentsLeft -= 1 + extent->lists;
+	} else {
+		is->nextExtent = NULL;
+		end = measureList(is, start);
+		if (end < 0)
+			return NULL;
+		extent = arenaAllocate(is->arena,
+			is->extentsCount * sizeof (sexpListExtent));
+		memcpy(extent, is->extents, is->extentsCount * sizeof (sexpListExtent));
+	}
+	if (is->maxDepth >= 0 && is->depth >= is->maxDepth)
+		sexpError(is, SEXP_ERR_DEPTH,
+			"Lists nested more than %ld deep.", is->maxDepth);
+	lazy = arenaAllocate(is->arena, sizeof (sexpLazyList));
+	lazy->type = SEXP_LAZY_LIST;
+	lazy->bytes = is->buffer + start;
+	lazy->length = end - start;
+	lazy->offset = is->count;
+	lazy->depth = is->depth + 1;
+	lazy->is = is;
+	lazy->extents = extent;
+	lazy->list = NULL;
+	/* go on from its ) */
+	is->position = end;
+	is->count += end - start - 1;
+	is->getChar(is);
+	return (sexpObject *) lazy;
+}
+
+/* scanLazyList(lazy)
+ * Returns the items of lazy as a list, scanning them the first time.
+ * The stream lazy was read from scans them out of its bytes, and is
+ * then left where it was.  Errors in them are reported as usual, so
+ * outside sexpParseObject() they exit.
+ */
+sexpList *
+scanLazyList(sexpLazyList *lazy)
+{
+	sexpInputStream *is = lazy->is;
+	sexpList *list, *tail;
+	sexpListExtent *nextExtent = is->nextExtent;
+	uint8_t *buffer = is->buffer;
+	size_t bufferLength = is->bufferLength, position = is->position;
+	size_t extentsLeft = is->extentsLeft;
+	int mapped = is->mapped, nextChar = is->nextChar;
+	long int count = is->count;
+	int byteSize = is->byteSize, bits = is->bits, nBits = is->nBits;
+	long int depth = is->depth;
+	if (lazy->list != NULL)
+		return lazy->list;
+	is->buffer = lazy->bytes;
+	is->bufferLength = lazy->length;
+	is->position = 1;
+	is->mapped = true;
+	is->count = lazy->offset;
+	is->depth = lazy->depth;
+	is->nextExtent = lazy->extents + 1;
+	is->extentsLeft = lazy->extents->lists;
+	changeInputByteSize(is, 8);
+	is->nextChar = '(';
+	is->getChar(is);
+	list = tail = newSexpList(is->arena);
+	for (;;) {
+		skipWhiteSpace(is);
+		if (is->nextChar == ')' || is->nextChar == EOF)
+			break;
+		tail = sexpAppendSexpListObject(is->arena, tail, scanObject(is));
+	}
+	skipChar(is, ')');
+	if (is->nextChar != EOF)
+		sexpError(is, SEXP_ERR_SYNTAX,
+			"character %x (hex) found after end of list",
+			(int) is->nextChar);
+	closeSexpList(list);
+	is->buffer = buffer;
+	is->bufferLength = bufferLength;
+	is->position = position;
+	is->mapped = mapped;
+	is->nextChar = nextChar;
+	is->count = count;
+	is->byteSize = byteSize;
+	is->bits = bits;
+	is->nBits = nBits;
+	is->depth = depth;
+	is->nextExtent = nextExtent;
+	is->extentsLeft = extentsLeft;
+	return lazy->list = list;
 }
 
 /* scanObject(is)
- * Reads and returns a sexpObject from the given input stream.
+ * Reads and returns a sexpObject from the given input stream, as a
+ * tape if is->tapes is set.  If is->lazy is set, a list is left to be
+ * scanned when its items are wanted, where it can be.  If is->snapshot
+ * is set, the object is decoded from a snapshot instead.
  */
 sexpObject *
 scanObject(sexpInputStream *is)
 {
+	sexpTreeBuilder *tb = is->builder->data;
 	sexpObject *object;
-	skipWhiteSpace(is);
-	if (is->nextChar == '{') {
-		changeInputByteSize(is, 6);	/* order of this statement and next is */
-		skipChar(is, '{');			/* Important! */
-		object = scanObject(is);
-		skipChar(is, '}');
-		return object;
-	} else {
-		if (is->nextChar == '(')
-			object = (sexpObject *) scanList(is);
-		else
-			object = (sexpObject *) scanString(is);
+	if (is->snapshot)
+		return scanSnapshotObject(is);
+	if (is->lazy && is->nextChar == '('
+		&& (object = newLazyList(is)) != NULL)
 		return object;
+	if (is->tapes)
+		return scanTape(is);
+	tb->depth = 0;
+	scanEvents(is, is->builder);
+	return tb->object;
+}
+
+/* sexpParseObject(is, object)
+ * Reads the next object from the input stream into *object, for
+ * programs using sexp as a library.  Returns SEXP_OK, or SEXP_EOF if
+ * there are no more objects, or the kind of error met, in which case
+ * is->errorMessage says what it was and is->errorOffset where.  After
+ * an error, the stream can only be freed.  Objects are allocated in
+ * is->arena, and stay valid until it is released.
+ */
+int
+sexpParseObject(sexpInputStream *is, sexpObject **object)
+{
+	jmp_buf onError;
+	uint8_t *buffer = is->buffer;
+	size_t bufferLength = is->bufferLength;
+	int mapped = is->mapped;
+	*object = NULL;
+	if (is->error != SEXP_OK)
+		return is->error;
+	is->onError = is->arena->onError = &onError;
+	if (setjmp(onError) != 0) {
+		if (is->error == SEXP_OK) {
+			/* out of memory: the arena has jumped here directly */
+			is->error = SEXP_ERR_MEMORY;
+			is->errorOffset = is->count;
+			strcpy(is->errorMessage, "Out of memory.");
+		}
+		/* the error may have come within a {...} region */
+		is->buffer = buffer;
+		is->bufferLength = bufferLength;
+		is->mapped = mapped;
+		is->onError = is->arena->onError = NULL;
+		return is->error;
+	}
+	changeInputByteSize(is, 8);
+	skipWhiteSpace(is);
+	if (is->nextChar != EOF) {
+		SEXP_BEGIN_OBJECT(is);
+		*object = scanObject(is);
+		SEXP_END_OBJECT(is);
+	}
+	is->onError = is->arena->onError = NULL;
+	return *object != NULL ? SEXP_OK : SEXP_EOF;
+}
+
+/* scanList(is)
+ * Read and return a sexpList from the input stream.
+ */
+sexpList *
+scanList(sexpInputStream *is)
+{
+	if (is->nextChar != '(')
+		skipChar(is, '(');
+	return (sexpList *) scanObject(is);
+}
+
+/*********************/
+/* OBJECT BOUNDARIES */
+/*********************/
+
+/* skipPast(buffer, length, i, c)
+ * Returns the offset just past the next c at or after i in buffer,
+ * or 0 if there is none.
+ */
+static size_t
+skipPast(uint8_t *buffer, size_t length, size_t i, int c)
+{
+	uint8_t *p;
+	p = memchr(buffer + i, c, length - i);
+	return p == NULL ? 0 : p - buffer + 1;
+}
+
+/* beginListExtent(is, i, open)
+ * Adds the extent of the list beginning at offset i to those of is,
+ * within the list whose extent is numbered open, from 1, or 0 if none.
+ * Until the list ends, its extent holds its start and that number.
+ * Returns the number of the new extent.
+ */
+static size_t
+beginListExtent(sexpInputStream *is, size_t i, size_t open)
+{
+	sexpListExtent *e;
+	if (is->extentsCount == is->extentsSize) {
+		is->extentsSize = 64 + 2 * is->extentsSize;
+		e = realloc(is->extents, is->extentsSize * sizeof (sexpListExtent));
+		if (e == NULL)
+			outOfMemory(is->arena, "list extents");
+		is->extents = e;
+	}
+	e = &is->extents[is->extentsCount++];
+	e->length = i;
+	e->lists = open;
+	return is->extentsCount;
+}
+
+/* endListExtent(is, i, open)
+ * Completes the extent numbered open, of the list ending just before
+ * offset i.  Returns the number of that of the list it is in.
+ */
+static size_t
+endListExtent(sexpInputStream *is, size_t i, size_t open)
+{
+	sexpListExtent *e = &is->extents[open - 1];
+	size_t outer = e->lists;
+	e->length = i - e->length;
+	e->lists = is->extentsCount - open;
+	return outer;
+}
+
+/* findEnd(buffer, length, position, start, is)
+ * Does the work of findObjectEnd(), and if is isn't NULL keeps the
+ * extents of the lists met in is->extents.
+ */
+static long int
+findEnd(uint8_t *buffer, size_t length, size_t position, size_t *start,
+	sexpInputStream *is)
+{
+	size_t i = position, j;
+	unsigned long int n;
+	long int depth = 0;
+	size_t open = 0;
+	int c, hint = false;
+	while (i < length && charClass[buffer[i]] & SEXP_WHITESPACE)
+		i++;
+	if (start != NULL)
+		*start = i;
+	while (i < length) {
+		if (depth > 0 && !hint) {
+			/* within a list, only tokens and white space come before
+			 * the next structural character, so they are passed over in
+			 * bulk -- but a digit there may be within a token */
+			j = i + findStructural(buffer + i, length - i);
+			if (j >= length)
+				return -1;
+			if (j > i && charClass[buffer[j - 1]] & SEXP_TOKENCHAR
+				&& charClass[buffer[j]] & SEXP_DECDIGIT) {
+				for (i = j; i < length && charClass[buffer[i]] & SEXP_TOKENCHAR;)
+					i++;
+				continue;
+			}
+			i = j;
+		}
+		c = buffer[i++];
+		if (c == '(') {
+			if (is != NULL)
+				open = beginListExtent(is, i - 1, open);
+			depth++;
+			continue;
+		} else if (c == ')') {
+			if (is != NULL && open > 0)
+				open = endListExtent(is, i, open);
+			depth--;
+		} else if (c == '"') {
+			/* the quote ends it unless escaped by an odd number of \'s */
+			do {
+				if ((j = skipPast(buffer, length, i, '"')) == 0)
+					return -1;
+				for (n = 0; j > i + 1 + n && buffer[j - 2 - n] == '\\';)
+					n++;
+				i = j;
+			} while (n % 2 == 1);
+		} else if (c == '[') {
+			/* the hint is a string of any form, which may hold a ] */
+			hint = true;
+			continue;
+		} else if (c == '|' || c == '#' || c == '{') {
+			i = skipPast(buffer, length, i, c == '{' ? '}' : c);
+			if (i == 0)
+				return -1;
+		} else if (charClass[c] & SEXP_DECDIGIT) {
+			for (n = c - '0'; i < length && charClass[buffer[i]] & SEXP_DECDIGIT; i++)
+				if (n < 1000000000)
+					n = 10 * n + (buffer[i] - '0');
+			if (i >= length)
+				return -1;
+			if (buffer[i] != ':')
+				continue;	/* a quoted, hex or base64 string follows */
+			if (n > length - i - 1)
+				return -1;
+			i += 1 + n;
+		} else if (charClass[c] & SEXP_TOKENCHAR) {
+			while (i < length && charClass[buffer[i]] & SEXP_TOKENCHAR)
+				i++;
+			if (i >= length)
+				return -1;	/* the token may go on */
+		} else if (charClass[c] & SEXP_WHITESPACE)
+			continue;
+		if (hint) {
+			/* the string itself follows the ] ending the hint */
+			while (i < length && charClass[buffer[i]] & SEXP_WHITESPACE)
+				i++;
+			if (i >= length)
+				return -1;
+			if (buffer[i] == ']')
+				i++;
+			hint = false;
+			continue;
+		}
+		if (depth <= 0)
+			return i;
+	}
+	return -1;
+}
+
+/* findObjectEnd(buffer, length, position, start)
+ * Finds where the object starting at position in buffer (after any
+ * white space) ends, without scanning it: follows the nesting of lists
+ * and skips over strings, using declared lengths of verbatim strings.
+ * Stores where the object starts in *start, unless start is NULL.
+ * Returns the offset just past the object, or -1 if buffer ends first.
+ * Input that isn't well formed just ends somewhere; scanning it will
+ * report the error.
+ */
+long int
+findObjectEnd(uint8_t *buffer, size_t length, size_t position, size_t *start)
+{
+	return findEnd(buffer, length, position, start, NULL);
+}
+
+/* measureList(is, start)
+ * Finds where the list at offset start in the buffer of is ends, as
+ * findObjectEnd() does, keeping the extents of it and of the lists
+ * within it in is->extents.
+ */
+long int
+measureList(sexpInputStream *is, size_t start)
+{
+	is->extentsCount = 0;
+	return findEnd(is->buffer, is->bufferLength, start, NULL, is);
+}
+
+/* readObjectsError(is, code, offset, message)
+ * Records an error of the given kind at offset in the input, for
+ * readObjects(), and returns its kind.
+ */
+static int
+readObjectsError(sexpInputStream *is, int code, long int offset,
+	const char *message)
+{
+	is->error = code;
+	is->errorOffset = offset;
+	snprintf(is->errorMessage, sizeof (is->errorMessage), "%s at %ld.",
+		message, offset);
+	return code;
+}
+
+/* readObjectsLeft(is, buffer, length, used, offset)
+ * Returns SEXP_OK if only white space follows the used bytes of the
+ * last length bytes of input at buffer, which are at offset in it, or
+ * records what does as an incomplete object.
+ */
+static int
+readObjectsLeft(sexpInputStream *is, uint8_t *buffer, size_t length,
+	size_t used, long int offset)
+{
+	while (used < length && charClass[buffer[used]] & SEXP_WHITESPACE)
+		used++;
+	if (used < length)
+		return readObjectsError(is, SEXP_ERR_SYNTAX,
+			offset + (long int) used, "Incomplete object");
+	return SEXP_OK;
+}
+
+/* readObjects(is, process, data)
+ * Hands the rest of the input of is, from its start, to
+ * process(data, buffer, length, offset, all) in pieces, where offset is
+ * that of buffer in the input.  process() uses whole objects from the
+ * start of buffer, and returns how many bytes it used; when all is set
+ * the input has ended, and what it leaves is an incomplete object.
+ * Mapped input is handed over in one piece.  Otherwise a partial object
+ * is kept and looked at again once the bytes held have doubled, so that
+ * it isn't searched over and over.  Returns SEXP_OK, or the kind of
+ * error met, which is recorded in is as sexpParseObject() does.
+ */
+int
+readObjects(sexpInputStream *is, size_t (*process)(), void *data)
+{
+	uint8_t *buffer, *larger;
+	size_t length = 0, size = 16 * INPUTBUFFERSIZE, used, wanted = 0;
+	long int offset = 0;
+	ssize_t n = 1;
+	int code = SEXP_OK;
+	if (is->mapped) {
+		used = process(data, is->buffer, is->bufferLength, 0L, true);
+		return readObjectsLeft(is, is->buffer, is->bufferLength, used, 0L);
+	}
+	buffer = malloc(size);
+	if (buffer == NULL)
+		return readObjectsError(is, SEXP_ERR_MEMORY, 0L,
+			"Can't allocate input buffer");
+	while (n > 0) {
+		if (length == size) {
+			larger = realloc(buffer, 2 * size);
+			if (larger == NULL) {
+				code = readObjectsError(is, SEXP_ERR_MEMORY,
+					offset + (long int) length, "Can't allocate input buffer");
+				break;
+			}
+			buffer = larger;
+			size *= 2;
+		}
+		do
+			n = read(fileno(is->inputFile), buffer + length, size - length);
+		while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			code = readObjectsError(is, SEXP_ERR_INPUT,
+				offset + (long int) length, "Can't read input");
+			break;
+		}
+		length += n;
+		if (n > 0 && length < wanted)
+			continue;
+		used = process(data, buffer, length, offset, n == 0);
+		if (n == 0)
+			code = readObjectsLeft(is, buffer, length, used, offset);
+		memmove(buffer, buffer + used, length - used);
+		length -= used;
+		offset += used;
+		wanted = 2 * length;
 	}
+	free(buffer);
+	return code;
 }
@@ -3,10 +3,22 @@
 int
 main(int argc, char **argv)
 {
-	char *c; int i;
+	char *c, *key = NULL, *query = NULL;
+	int i, workers = 0, hash = 0, phase;
+	long int record = -1;
+	uint8_t *data = NULL;
+	size_t dataLength = 0;
 	bool swa = true, swb = true, swc = true, swp = true, sws = false, 
-		swx = true, swl = false;
+		swx = true, swl = false, swn = false, snapshot = false, stream,
+		objectStats = false;
 	sexpObject *object;
+	sexpIter *iter;
+	sexpHash h;
+	uint8_t digest[SEXP_MAXDIGESTSIZE];
+	sexpEventSink *sink;
+	sexpBatch *batch;
+	sexpIndex *index = NULL;
+	sexpStats *stats = NULL, previous;
 	sexpInputStream *is;
 	sexpOutputStream *os;
 	initializeCharacterTables();
@@ -27,18 +39,48 @@ main(int argc, char **argv)
 		c++;
 		if (*c == 'a')			/* advanced output */
 			swa = true;
-		else if (*c == 'b')		/* Base64 output */
+		else if (*c == 'A') {	/* keep one copy of each short string */
+			if (is->atoms == NULL)
+				is->atoms = newSexpAtomTable();
+		} else if (*c == 'b')		/* Base64 output */
 			swb = true;
 		else if (*c == 'c')		/* canonical output */
 			swc = true;
-		else if (*c == 'i') {	/* input file */
+		else if (*c == 'd') {	/* limit depth of lists */
 			if (i + 1 < argc)
 				i++;
-			is->inputFile = fopen(argv[i], "r");
-			if (is->inputFile == NULL)
+			is->maxDepth = atol(argv[i]);
+		} else if (*c == 'H') {	/* print hashes of canonical forms */
+			if (i + 1 < argc)
+				i++;
+			hash = hashAlgorithm(argv[i]);
+			if (hash == 0)
+				errx(1, "Unknown hash algorithm %s.", argv[i]);
+		} else if (*c == 'i') {	/* input file */
+			if (i + 1 < argc)
+				i++;
+			if (!openSexpInputFile(is, argv[i]))
 				err(1, "%s", "Can't open input file.");
-		} else if (*c == 'l')	/* suppress linefeeds after output */
+		} else if (*c == 'I') {	/* read objects through an index */
+			if (i + 1 < argc)
+				i++;
+			index = newSexpIndex(fopen(argv[i], "r"));
+			if (index->file == NULL)
+				err(1, "%s", "Can't open index file.");
+		} else if (*c == 'j') {	/* parse with a pool of workers */
+			if (i + 1 < argc)
+				i++;
+			workers = atoi(argv[i]);
+		} else if (*c == 'k') {	/* select records by key */
+			if (i + 1 < argc)
+				i++;
+			key = argv[i];
+		} else if (*c == 'L')	/* scan lists only when needed */
+			is->lazy = true;
+		else if (*c == 'l')	/* suppress linefeeds after output */
 			swl = true;
+		else if (*c == 'n')	/* list offsets of objects */
+			swn = true;
 		else if (*c == 'o') {	/* output file */
 			if (i + 1 < argc)
 				i++;
@@ -47,12 +89,35 @@ main(int argc, char **argv)
 				err(1, "%s", "Can't open output file.");
 		} else if (*c == 'p')	/* prompt for input */
 			swp = true;
+		else if (*c == 'q') {	/* print what a path selects */
+			if (i + 1 < argc)
+				i++;
+			query = argv[i];
+			is->lazy = true;
+		} else if (*c == 'R')	/* read a snapshot */
+			is->snapshot = true;
+		else if (*c == 'r') {	/* select a record by number */
+			if (i + 1 < argc)
+				i++;
+			record = atol(argv[i]);
+		} else if (*c == 'S')	/* write a snapshot */
+			snapshot = true;
 		else if (*c == 's')		/* treat input as one big string */
 			sws = true;
+		else if (*c == 't')		/* parse objects into tapes */
+			is->tapes = true;
 		else if (*c == 'w') {	/* set output width */
 			if (i + 1 < argc)
 				i++;
 			os->maxcolumn = atoi(argv[i]);
+		} else if (*c == 'v' || *c == 'V') {	/* print statistics */
+#ifdef SEXP_NO_STATS
+			errx(1, "%s", "Statistics were left out of this build.");
+#endif
+			if (stats == NULL)
+				stats = newSexpStats();
+			if (*c == 'V')		/* for each object too */
+				objectStats = true;
 		} else if (*c == 'x')	/* execute repeatedly */
 			swx = true;
 		else {
@@ -60,83 +125,212 @@ main(int argc, char **argv)
 			exit(1);
 		}
 	}
-	if (swa == false && swb == false && swc == false)
+	if (is->snapshot && !is->mapped)
+		errx(1, "%s", "A snapshot must be read from a regular file (-i).");
+	if ((record > 0 || key != NULL) && index == NULL)
+		errx(1, "%s", "Selecting records needs an index (-I).");
+	if (swa == false && swb == false && swc == false && hash == 0)
 		swc = true;		/* must have some output format! */
+	if (!swp)
+		setvbuf(os->outputFile, NULL, _IOFBF, OUTPUTBUFFERSIZE);
+	if (stats != NULL) {
+		is->stats = is->arena->stats = os->stats = stats;
+		previous = *stats;
+	}
+	if (swn) {
+		if (readObjects(is, writeIndexEntries, newSexpIndex(os->outputFile))
+			!= SEXP_OK)
+			errx(1, "%s", is->errorMessage);
+		goto done;
+	}
+	if (snapshot) {
+		if (writeSnapshot(is, os->outputFile) != SEXP_OK)
+			errx(1, "%s", is->errorMessage);
+		goto done;
+	}
+	/* separate objects can be done in parallel, when they are printed
+	 * each on its own lines */
+	if (workers > 0 && swx && !swp && !sws && !swl && index == NULL
+		&& !is->snapshot && !objectStats) {
+		batch = newSexpBatch(workers);
+		batch->canonical = swc;
+		batch->base64 = swb;
+		batch->advanced = swa;
+		batch->tapes = is->tapes;
+		batch->lazy = is->lazy;
+		batch->atoms = is->atoms != NULL;
+		batch->query = query;
+		batch->hash = hash;
+		batch->maxcolumn = os->maxcolumn;
+		batch->maxDepth = is->maxDepth;
+		batch->stats = stats;
+		batchProcess(batch, is, os, workers);
+		goto done;
+	}
+	/* a single canonical, base64 or hash output can be printed as it
+	 * is read */
+	stream = (swc + swb + (hash != 0) == 1) && !swa && !sws && !swp
+		&& query == NULL && !is->snapshot;
+	sink = newCanonicalSink(os);
 
-	/* main loop */
-	if (swp)
-		is->nextChar = -2;	/* this is not EOF */
-	else
-		is->getChar(is);
+	/* with an index, the input is the records it selects, one by one */
+	if (index != NULL) {
+		if (!is->mapped)
+			errx(1, "%s", "An index needs a regular input file.");
+		data = is->buffer;
+		dataLength = is->bufferLength;
+		if (record > 0 && !seekIndexRecord(index, record))
+			errx(1, "%s", index->errorMessage);
+	}
 
-	while (is->nextChar != EOF) {
-		if (swp) {
-			fprintf(stderr, "Input: ");
-			fflush(stdout);
+	for (;;) {
+		if (index != NULL) {
+			if (!readIndexEntry(index)) {
+				if (index->errorMessage[0] != '\0')
+					errx(1, "%s", index->errorMessage);
+				break;
+			}
+			if (record > 0 && index->record != record)
+				break;
+			if (key != NULL && strcmp(index->key, key) != 0)
+				continue;
+			if ((size_t) index->offset > dataLength
+				|| (size_t) index->length > dataLength - index->offset)
+				errx(1, "Record %ld is past the end of input.", index->record);
+			resetSexpMemoryInputStream(is, data + index->offset, index->length);
+			is->count = index->offset - 1;
+			SEXP_COUNT(stats, inputBase, index->offset - stats->inputBase);
 		}
 
-		changeInputByteSize(is, 8);
-		if (is->nextChar == -2)
-			is->getChar(is);
-
-		skipWhiteSpace(is);
-		if (is->nextChar == EOF)
-			break;
-
-		if (sws)
-			object = scanToEOF(is);
+		/* main loop */
+		if (swp)
+			is->nextChar = -2;	/* this is not EOF */
 		else
-			object = scanObject(is);
+			is->getChar(is);
 
-		if (swc) {
+		while (is->nextChar != EOF) {
 			if (swp) {
-				fprintf(stderr, "Canonical output: ");
-				fflush(stdout);
-				os->newLine(os, ADVANCED);
-			}
-			canonicalPrintObject(os, object);
-			if (!swl) {
-				putchar('\n');
+				fprintf(stderr, "Input: ");
 				fflush(stdout);
 			}
-		}
 
-		if (swb) {
-			if (swp) {
-				fprintf(stderr, "Base64 (of canonical) output: ");
-				fflush(stdout);
-				os->newLine(os, ADVANCED);
-			}
-			base64PrintWholeObject(os, object);
-			if (!swl) {
-				putchar('\n');
-				fflush(stdout);
+			changeInputByteSize(is, 8);
+			if (is->nextChar == -2)
+				is->getChar(is);
+
+			skipWhiteSpace(is);
+			if (is->nextChar == EOF)
+				break;
+
+			SEXP_BEGIN_OBJECT(is);
+			if (stream) {
+				if (hash)
+					beginHash(os, &h, hash);
+				else if (swc)
+					changeOutputByteSize(os, 8, CANONICAL);
+				else
+					base64BeginWholeObject(os);
+				scanEvents(is, sink);
+				SEXP_END_OBJECT(is);
+				if (hash)
+					printDigest(os, digest, endHash(os, digest));
+				if (swb)
+					base64EndWholeObject(os);
+				if (!swl)
+					os->newLine(os, ADVANCED);
+			} else {
+				if (sws)
+					object = scanToEOF(is);
+				else
+					object = scanObject(is);
+				SEXP_END_OBJECT(is);
+				phase = SEXP_ENTER(stats, SEXP_PHASE_PRINT);
+
+				/* with a query, the objects printed are those it selects */
+				iter = NULL;
+				if (query != NULL) {
+					iter = sexpListIter(sexpQuery(is->arena, object, query));
+					object = sexpIterObject(iter);
+				}
+				while (object != NULL) {
+					if (swc) {
+						if (swp) {
+							fprintf(stderr, "Canonical output: ");
+							fflush(stdout);
+							os->newLine(os, ADVANCED);
+						}
+						changeOutputByteSize(os, 8, CANONICAL);
+						canonicalPrintObject(os, object);
+						if (!swl)
+							os->newLine(os, ADVANCED);
+					}
+
+					if (swb) {
+						if (swp) {
+							fprintf(stderr, "Base64 (of canonical) output: ");
+							fflush(stdout);
+							os->newLine(os, ADVANCED);
+						}
+						base64PrintWholeObject(os, object);
+						if (!swl)
+							os->newLine(os, ADVANCED);
+					}
+
+					if (swa) {
+						if (swp) {
+							fprintf(stderr, "Advanced transport output: ");
+							fflush(stdout);
+							os->newLine(os, ADVANCED);
+						}
+						changeOutputByteSize(os, 8, ADVANCED);
+						advancedPrintObject(os, object);
+						if (!swl)
+							os->newLine(os, ADVANCED);
+					}
+
+					if (hash) {
+						if (swp) {
+							fprintf(stderr, "Hash of canonical output: ");
+							fflush(stdout);
+							os->newLine(os, ADVANCED);
+						}
+						hashPrintObject(os, object, hash);
+						if (!swl)
+							os->newLine(os, ADVANCED);
+					}
+
+					iter = sexpIterNext(iter);
+					object = sexpIterObject(iter);
+				}
+				SEXP_LEAVE(stats, phase);
 			}
-		}
+			if (objectStats)
+				printSexpObjectStats(stats, &previous, stderr);
 
-		if (swa) {
-			if (swp) {
-				fprintf(stderr, "Advanced transport output: ");
-				fflush(stdout);
+			/* object is no longer needed; give back its memory */
+			releaseSexpArena(is->arena);
+
+			if (!swx)
+				break;
+
+			if (!swp)
+				skipWhiteSpace(is);
+			else if (!swl)
 				os->newLine(os, ADVANCED);
-			}
-			advancedPrintObject(os, object);
-			if (!swl) {
-				putchar('\n');
-				fflush(stdout);
-			}
+
+			/* don't hold output back while waiting for more input */
+			if (swp || is->position >= is->bufferLength)
+				fflush(os->outputFile);
 		}
 
-		if (!swx)
+		if (index == NULL)
 			break;
-
-		if (!swp)
-			skipWhiteSpace(is);
-		else if (!swl) {
-			putchar('\n');
-			fflush(stdout);
-		}
 	}
 
+  done:
+	if (stats != NULL) {
+		fflush(os->outputFile);
+		printSexpStats(stats, stderr);
+	}
 	return 0;
 }
@@ -15,8 +15,21 @@ static const char *base64Digits =
 void
 putChar(sexpOutputStream *os, int c)
 {
-	putc(c, os->outputFile);
+	putc_unlocked(c, os->outputFile);
 	os->column++;
+	SEXP_COUNT(os->stats, bytesOut[SEXP_REGION(os->byteSize)], 1);
+}
+
+/* putBytes(os, bytes, n)
+ * Puts the n bytes at bytes out on the output stream os in one go.
+ * Keeps track of the "column" the next output char will go to.
+ */
+void
+putBytes(sexpOutputStream *os, uint8_t *bytes, long int n)
+{
+	fwrite(bytes, 1, n, os->outputFile);
+	os->column += n;
+	SEXP_COUNT(os->stats, bytesOut[SEXP_REGION(os->byteSize)], n);
 }
 
 /* varPutChar(os, c)
@@ -45,6 +58,74 @@ varPutChar(sexpOutputStream *os, int c)
 	}
 }
 
+/* putEncodedChars(os, chars, n)
+ * Puts out n hex or base64 characters at chars, breaking lines at
+ * maxcolumn just as varPutChar does, but a line's worth at a time.
+ */
+void
+putEncodedChars(sexpOutputStream *os, uint8_t *chars, long int n)
+{
+	long int run;
+	os->base64Count += n;
+	while (n > 0) {
+		if (os->maxcolumn > 0 && os->column >= os->maxcolumn)
+			os->newLine(os, os->mode);
+		run = n;
+		if (os->maxcolumn > 0 && os->maxcolumn - os->column < run)
+			run = os->maxcolumn - os->column > 0
+				? os->maxcolumn - os->column : 1;
+		os->putBytes(os, chars, run);
+		chars += run;
+		n -= run;
+	}
+}
+
+/* varPutBytes(os, bytes, n)
+ * varPutChar for each of the n bytes at bytes.
+ * Bytes going out unchanged are written in runs with os->putBytes.
+ */
+void
+varPutBytes(sexpOutputStream *os, uint8_t *bytes, long int n)
+{
+	long int i, start = 0, run;
+	uint8_t chars[ENCODEBUFFERSIZE];
+	if (os->byteSize != 8) {
+		/* finish any partly output group of bytes first */
+		while (n > 0 && os->nBits != 0) {
+			varPutChar(os, *bytes++);
+			n--;
+		}
+		/* then encode whole groups a block at a time */
+		while (n >= 3 || (n > 0 && os->byteSize == 4)) {
+			if (os->byteSize == 6) {
+				run = n < ENCODEBUFFERSIZE / 4 * 3 ? n / 3 * 3
+					: ENCODEBUFFERSIZE / 4 * 3;
+				putEncodedChars(os, chars, encodeBase64(chars, bytes, run));
+			} else {
+				run = n < ENCODEBUFFERSIZE / 2 ? n : ENCODEBUFFERSIZE / 2;
+				putEncodedChars(os, chars, encodeHex(chars, bytes, run));
+			}
+			bytes += run;
+			n -= run;
+		}
+		while (n-- > 0)
+			varPutChar(os, *bytes++);
+		return;
+	}
+	/* varPutChar breaks the line before a {, }, # or | past maxcolumn */
+	if (os->maxcolumn > 0 && os->mode != CANONICAL)
+		for (i = 0; i < n; i++)
+			if ((bytes[i] == '{' || bytes[i] == '}'
+				 || bytes[i] == '#' || bytes[i] == '|')
+				&& os->column + (i - start) >= os->maxcolumn) {
+				os->putBytes(os, bytes + start, i - start);
+				os->newLine(os, os->mode);
+				start = i;
+			}
+	os->putBytes(os, bytes + start, n - start);
+	os->base64Count += n;
+}
+
 /* changeOutputByteSize(os, newByteSize, mode)
  * Change os->byteSize to newByteSize
  * record mode in output stream for automatic line breaks
@@ -120,15 +201,47 @@ newSexpOutputStream()
 	os->maxcolumn = DEFAULTLINELENGTH;
 	os->indent = 0;
 	os->putChar = putChar;
+	os->putBytes = putBytes;
 	os->newLine = newLine;
 	os->byteSize = 8;
 	os->bits = 0;
 	os->nBits = 0;
 	os->outputFile = stdout;
 	os->mode = CANONICAL;
+	os->layout = NULL;
+	os->layoutSize = 0;
+	os->layoutCount = 0;
+	os->layoutNext = 0;
+	os->stack = NULL;
+	os->stackSize = 0;
+	os->stackDepth = 0;
+	os->hash = NULL;
+	os->stats = NULL;
 	return os;
 }
 
+/* pushOutputFrame(os, iter)
+ * Pushes a frame for walking the list iter onto the stack of os.
+ * Returns the new frame, which is valid until the next push.
+ */
+sexpOutputFrame *
+pushOutputFrame(sexpOutputStream *os, sexpIter *iter)
+{
+	sexpOutputFrame *f;
+	if (os->stackDepth == os->stackSize) {
+		os->stackSize = 16 + 2 * os->stackSize;
+		os->stack = realloc(os->stack, os->stackSize * sizeof (sexpOutputFrame));
+		if (os->stack == NULL)
+			err(1, "%s", "Can't allocate list stack.");
+	}
+	f = &os->stack[os->stackDepth++];
+	f->iter = iter;
+	f->layout = 0;
+	f->vertical = false;
+	f->first = true;
+	return f;
+}
+
 /*******************/
 /* OUTPUT ROUTINES */
 /*******************/
@@ -139,10 +252,9 @@ newSexpOutputStream()
 void
 printDecimal(sexpOutputStream *os, long int n)
 {
-	char buffer[64]; int i;
+	char buffer[64];
 	sprintf(buffer, "%ld", n);
-	for (i = 0; buffer[i] != 0; i++)
-		varPutChar(os, buffer[i]);
+	varPutBytes(os, (uint8_t *) buffer, (long int) strlen(buffer));
 }
 
 /********************/
@@ -156,7 +268,6 @@ void
 canonicalPrintVerbatimSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 {
 	long int len;
-	long int i;
 	uint8_t *c;
 	len = simpleStringLength(ss);
 	c = simpleStringString(ss);
@@ -166,8 +277,7 @@ canonicalPrintVerbatimSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 	printDecimal(os, len);
 	varPutChar(os, ':');
 	/* print characters in fragment */
-	for (i = 0; i < len; i++)
-		varPutChar(os, (int) *c++);
+	varPutBytes(os, c, len);
 }
 
 /* canonicalPrintString(os, s)
@@ -195,32 +305,73 @@ canonicalPrintString(sexpOutputStream *os, sexpString *s)
 void
 canonicalPrintList(sexpOutputStream *os, sexpList *list)
 {
-	sexpIter *iter;
-	sexpObject *object;
-	varPutChar(os, '(');
-	iter = sexpListIter(list);
-	while (iter != NULL) {
-		object = sexpIterObject(iter);
-		if (object != NULL)
-			canonicalPrintObject(os, object);
-		iter = sexpIterNext(iter);
+	canonicalPrintObject(os, (sexpObject *) list);
+}
+
+/* canonicalPrintTape(os, tape)
+ * Prints out the object of a tape on os, taking its nodes in order.
+ * Each list ends where its size says; the stack of os keeps the ends
+ * of the lists open.
+ */
+void
+canonicalPrintTape(sexpOutputStream *os, sexpTapeNode *node)
+{
+	long int base = os->stackDepth;
+	sexpTapeNode *end = node + node->size;
+	while (node < end) {
+		if (objectType(node) == SEXP_TAPE_LIST) {
+			varPutChar(os, '(');
+			pushOutputFrame(os, (sexpIter *) (node + node->size));
+			node++;
+		} else {
+			canonicalPrintString(os, (sexpString *) node);
+			node += node->size;
+		}
+		while (os->stackDepth > base
+			&& os->stack[os->stackDepth - 1].iter == (sexpIter *) node) {
+			varPutChar(os, ')');
+			os->stackDepth--;
+		}
 	}
-	varPutChar(os, ')');
 }
 
 /* canonicalPrintObject(os, object)
  * Prints out object on output stream os
  * Note that this uses the common "type" field of lists and strings.
+ * Lists within object are walked with the stack of os.
  */
 void
 canonicalPrintObject(sexpOutputStream *os, sexpObject *object)
 {
-	if (isObjectString(object))
-		canonicalPrintString(os, (sexpString *) object);
-	else if (isObjectList(object))
-		canonicalPrintList(os, (sexpList *) object);
-	else
-		err(1, "%s", "NULL object can't be printed.");
+	long int base = os->stackDepth;
+	sexpIter *iter;
+	if (isTapeNode(object)) {
+		canonicalPrintTape(os, (sexpTapeNode *) object);
+		return;
+	}
+	for (;;) {
+		if (isObjectString(object))
+			canonicalPrintString(os, (sexpString *) object);
+		else if (isObjectList(object)) {
+			varPutChar(os, '(');
+			pushOutputFrame(os, sexpListIter((sexpList *) object));
+		} else
+			err(1, "%s", "NULL object can't be printed.");
+		/* on to the next item, closing the lists that are done */
+		object = NULL;
+		while (object == NULL && os->stackDepth > base) {
+			iter = os->stack[os->stackDepth - 1].iter;
+			if (iter == NULL) {
+				varPutChar(os, ')');
+				os->stackDepth--;
+			} else {
+				object = sexpIterObject(iter);
+				os->stack[os->stackDepth - 1].iter = sexpIterNext(iter);
+			}
+		}
+		if (object == NULL)
+			return;
+	}
 }
 
 /* *************/
@@ -228,18 +379,86 @@ canonicalPrintObject(sexpOutputStream *os, sexpObject *object)
 /* *************/
 /* Same as canonical, except all characters get put out as Base64 ones */
 
+/* base64BeginWholeObject(os)
+ * Opens the {...} region an object is printed in, in base64 mode.
+ */
 void
-base64PrintWholeObject(sexpOutputStream *os, sexpObject *object)
+base64BeginWholeObject(sexpOutputStream *os)
 {
 	changeOutputByteSize(os, 8, BASE64);
 	varPutChar(os, '{');
 	changeOutputByteSize(os, 6, BASE64);
-	canonicalPrintObject(os, object);
+}
+
+/* base64EndWholeObject(os)
+ * Closes the {...} region opened by base64BeginWholeObject().
+ */
+void
+base64EndWholeObject(sexpOutputStream *os)
+{
 	flushOutput(os);
 	changeOutputByteSize(os, 8, BASE64);
 	varPutChar(os, '}');
 }
 
+void
+base64PrintWholeObject(sexpOutputStream *os, sexpObject *object)
+{
+	base64BeginWholeObject(os);
+	canonicalPrintObject(os, object);
+	base64EndWholeObject(os);
+}
+
+/**********************************/
+/* CANONICAL OUTPUT AS EVENT SINK */
+/**********************************/
+/* Prints objects in canonical form as scanEvents() reads them.
+ * Each string is printed and forgotten as soon as it is read. */
+
+/* canonicalOpenList(sink)
+ * Prints the opening parenthesis of a list.
+ */
+void
+canonicalOpenList(sexpEventSink *sink)
+{
+	varPutChar((sexpOutputStream *) sink->data, '(');
+}
+
+/* canonicalCloseList(sink)
+ * Prints the closing parenthesis of a list.
+ */
+void
+canonicalCloseList(sexpEventSink *sink)
+{
+	varPutChar((sexpOutputStream *) sink->data, ')');
+}
+
+/* canonicalString(sink, s)
+ * Prints string s, then gives back the memory it was read into.
+ */
+void
+canonicalString(sexpEventSink *sink, sexpString *s)
+{
+	canonicalPrintString((sexpOutputStream *) sink->data, s);
+	releaseSexpArena(sink->arena);
+}
+
+/* newCanonicalSink(os)
+ * Creates an event sink printing canonical output on os.
+ */
+sexpEventSink *
+newCanonicalSink(sexpOutputStream *os)
+{
+	sexpEventSink *sink;
+	sink = malloc(sizeof (sexpEventSink));
+	sink->openList = canonicalOpenList;
+	sink->closeList = canonicalCloseList;
+	sink->string = canonicalString;
+	sink->arena = newSexpArena();
+	sink->data = os;
+	return sink;
+}
+
 /*****************/
 /* ADVANCED MODE */
 /*****************/
@@ -253,19 +472,29 @@ base64PrintWholeObject(sexpOutputStream *os, sexpObject *object)
 int
 canPrintAsToken(sexpOutputStream *os, sexpSimpleString *ss)
 {
-	int i;
+	long int len = simpleStringLength(ss);
+	if (os->maxcolumn > 0 && os->column + len >= os->maxcolumn)
+		return false;
+	return isTokenSimpleString(ss);
+}
+
+/* isTokenSimpleString(ss)
+ * Returns true if the characters of simple string ss make a token,
+ * whether or not there is room for it on the current line.
+ */
+int
+isTokenSimpleString(sexpSimpleString *ss)
+{
+	long int i, len;
 	uint8_t *c;
-	long int len;
 	len = simpleStringLength(ss);
 	c = simpleStringString(ss);
 	if (len <= 0)
 		return false;
-	if (isdigit((int) *c))
-		return false;
-	if (os->maxcolumn > 0 && os->column + len >= os->maxcolumn)
+	if (charClass[*c] & SEXP_DECDIGIT)
 		return false;
 	for (i = 0; i < len; i++)
-		if (!isTokenChar((int) (*c++)))
+		if (!(charClass[*c++] & SEXP_TOKENCHAR))
 			return false;
 	return true;
 }
@@ -277,15 +506,13 @@ canPrintAsToken(sexpOutputStream *os, sexpSimpleString *ss)
 void
 advancedPrintTokenSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 {
-	int i;
 	long int len;
 	uint8_t *c;
 	len = simpleStringLength(ss);
 	if (os->maxcolumn > 0 && os->column > (os->maxcolumn - len))
 		os->newLine(os, ADVANCED);
 	c = simpleStringString(ss);
-	for (i = 0; i < len; i++)
-		os->putChar(os, (int) (*c++));
+	os->putBytes(os, c, len);
 }
 
 /* advancedLengthSimpleStringToken(ss)
@@ -307,7 +534,6 @@ void
 advancedPrintVerbatimSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 {
 	long int len = simpleStringLength(ss);
-	long int i;
 	uint8_t *c;
 	c = simpleStringString(ss);
 	if (c == NULL)
@@ -316,8 +542,7 @@ advancedPrintVerbatimSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 		os->newLine(os, ADVANCED);
 	printDecimal(os, len);
 	os->putChar(os, ':');
-	for (i = 0; i < len; i++)
-		os->putChar(os, (int) *c++);
+	os->putBytes(os, c, len);
 }
 
 /* advancedLengthSimpleStringVerbatim(ss)
@@ -343,15 +568,14 @@ advancedLengthSimpleStringVerbatim(sexpSimpleString *ss)
 void
 advancedPrintBase64SimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 {
-	long int i, len;
+	long int len;
 	uint8_t *c = simpleStringString(ss);
 	len = simpleStringLength(ss);
 	if (c == NULL)
 		err(1, "%s", "Can't print NULL string base 64");
 	varPutChar(os, '|');
 	changeOutputByteSize(os, 6, ADVANCED);
-	for (i = 0; i < len; i++)
-		varPutChar(os, (int) (*c++));
+	varPutBytes(os, c, len);
 	flushOutput(os);
 	changeOutputByteSize(os, 8, ADVANCED);
 	varPutChar(os, '|');
@@ -365,15 +589,14 @@ advancedPrintBase64SimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 void
 advancedPrintHexSimpleString(sexpOutputStream *os, sexpSimpleString *ss)
 {
-	long int i, len;
+	long int len;
 	uint8_t *c = simpleStringString(ss);
 	len = simpleStringLength(ss);
 	if (c == NULL)
 		err(1, "%s", "Can't print NULL string hexadecimal");
 	os->putChar(os, '#');
 	changeOutputByteSize(os, 4, ADVANCED);
-	for (i = 0; i < len; i++)
-		varPutChar(os, (int) (*c++));
+	varPutBytes(os, c, len);
 	flushOutput(os);
 	changeOutputByteSize(os, 8, ADVANCED);
 	os->putChar(os, '#');
@@ -404,7 +627,7 @@ canPrintAsQuotedString(sexpSimpleString *ss)
 	if (len < 0)
 		return false;
 	for (i = 0; i < len; i++, c++)
-		if (!isTokenChar((int) (*c)) && *c != ' ')
+		if (!(charClass[*c] & SEXP_TOKENCHAR) && *c != ' ')
 			return false;
 	return true;
 }
@@ -534,62 +757,276 @@ advancedLengthString(sexpOutputStream *os, sexpString *s)
 int
 advancedLengthList(sexpOutputStream *os, sexpList *list)
 {
-	int len = 1;	/* for left paren */
+	return advancedLengthListUpTo(os, list, LONG_MAX - 2);
+}
+
+/* LAYOUT */
+
+/* The printed length of a list depends on the column it is measured
+ * from, since a string that could be a token is quoted instead when it
+ * would reach maxcolumn.  Rather than measure every list again from
+ * each enclosing list, advancedLayoutObject() summarizes all lists of
+ * an object in one bottom-up pass, in the order in which they will be
+ * printed, and advancedPrintList() consumes one summary per list.
+ */
+
+/* advancedLayoutSimpleString(os, ss, layout)
+ * Adds printed image of simple string ss to the summary layout.
+ */
+void
+advancedLayoutSimpleString(sexpOutputStream *os, sexpSimpleString *ss,
+	sexpListLayout *layout)
+{
+	long int len = simpleStringLength(ss);
+	if (!isTokenSimpleString(ss)) {
+		if (canPrintAsQuotedString(ss))
+			layout->length += advancedLengthSimpleStringQuotedString(ss);
+		else if (len <= 4 && os->byteSize == 8)
+			layout->length += advancedLengthSimpleStringHexadecimal(ss);
+		else if (os->byteSize == 8)
+			layout->length += advancedLengthSimpleStringBase64(ss);
+		return;
+	}
+	/* a token, which is quoted from column maxcolumn - len on */
+	layout->length += advancedLengthSimpleStringToken(ss);
+	if (os->maxcolumn <= 0)
+		return;
+	if (layout->tokens == 0 || os->maxcolumn - len < layout->minQuoted)
+		layout->minQuoted = os->maxcolumn - len;
+	if (layout->tokens == 0 || os->maxcolumn - len > layout->maxQuoted)
+		layout->maxQuoted = os->maxcolumn - len;
+	layout->tokens++;
+}
+
+/* newListLayout(os)
+ * Adds an empty summary to os->layout.  Returns its index.
+ */
+long int
+newListLayout(sexpOutputStream *os)
+{
+	sexpListLayout *l;
+	if (os->layoutCount == os->layoutSize) {
+		os->layoutSize = 16 + 2 * os->layoutSize;
+		os->layout = realloc(os->layout,
+			os->layoutSize * sizeof (sexpListLayout));
+		if (os->layout == NULL)
+			err(1, "%s", "Can't allocate list layouts.");
+	}
+	l = &os->layout[os->layoutCount];
+	l->length = 2;	/* for parens */
+	l->tokens = 0;
+	return os->layoutCount++;
+}
+
+/* advancedLayoutList(os, list)
+ * Summarizes list and the lists within it into os->layout.
+ * A list is summarized when it is reached, and added into the summary
+ * of the list holding it when its walk is done.
+ * Returns the index of the summary of list.
+ */
+long int
+advancedLayoutList(sexpOutputStream *os, sexpList *list)
+{
+	long int base = os->stackDepth, n, m;
+	sexpListLayout *l, *sub;
+	sexpOutputFrame *f;
 	sexpIter *iter;
 	sexpObject *object;
-	iter = sexpListIter(list);
-	while (iter != NULL) {
+	sexpSimpleString *ph;
+	n = newListLayout(os);
+	pushOutputFrame(os, sexpListIter(list))->layout = n;
+	while (os->stackDepth > base) {
+		f = &os->stack[os->stackDepth - 1];
+		iter = f->iter;
+		if (iter == NULL) {
+			m = f->layout;
+			if (--os->stackDepth == base)
+				break;
+			l = &os->layout[os->stack[os->stackDepth - 1].layout];
+			sub = &os->layout[m];
+			l->length += sub->length;
+			if (sub->tokens > 0) {
+				if (l->tokens == 0 || sub->minQuoted < l->minQuoted)
+					l->minQuoted = sub->minQuoted;
+				if (l->tokens == 0 || sub->maxQuoted > l->maxQuoted)
+					l->maxQuoted = sub->maxQuoted;
+				l->tokens += sub->tokens;
+			}
+			l->length++;	/* for space after item */
+			continue;
+		}
+		f->iter = sexpIterNext(iter);
 		object = sexpIterObject(iter);
-		if (object != NULL) {
-			if (isObjectString(object))
-				len += advancedLengthString(os, ((sexpString *) object));
-			/* else */
-			if (isObjectList(object))
-				len += advancedLengthList(os, ((sexpList *) object));
-			len++;	/* for space after item */
+		if (object == NULL)
+			continue;
+		if (isObjectString(object)) {
+			l = &os->layout[f->layout];
+			ph = sexpStringPresentationHint((sexpString *) object);
+			if (ph != NULL) {
+				l->length += 2;
+				advancedLayoutSimpleString(os, ph, l);
+			}
+			if (sexpStringString((sexpString *) object) != NULL)
+				advancedLayoutSimpleString(os,
+					sexpStringString((sexpString *) object), l);
+			l->length++;	/* for space after item */
+		}
+		if (isObjectList(object)) {
+			m = newListLayout(os);
+			pushOutputFrame(os, sexpListIter((sexpList *) object))->layout = m;
 		}
-		iter = sexpIterNext(iter);
 	}
-	return len + 1;	/* for final paren */
+	return n;
 }
 
-/* advancedPrintList(os, list)
- * Prints out the list "list" onto output stream os.
+/* advancedLayoutObject(os, object)
+ * Computes the summaries for all lists of object, for printing it.
+ */
+void
+advancedLayoutObject(sexpOutputStream *os, sexpObject *object)
+{
+	os->layoutCount = 0;
+	os->layoutNext = 0;
+	if (isObjectList(object))
+		advancedLayoutList(os, (sexpList *) object);
+}
+
+/* advancedLengthListUpTo(os, list, limit)
+ * Returns length of printed image of list, as advancedLengthList()
+ * does, or some length greater than limit if it is greater than limit.
+ */
+long int
+advancedLengthListUpTo(sexpOutputStream *os, sexpList *list, long int limit)
+{
+	long int base = os->stackDepth, len = 1;	/* for left paren */
+	sexpIter *iter;
+	sexpObject *object;
+	pushOutputFrame(os, sexpListIter(list));
+	while (os->stackDepth > base) {
+		if (len > limit) {
+			os->stackDepth = base;
+			break;
+		}
+		iter = os->stack[os->stackDepth - 1].iter;
+		if (iter == NULL) {
+			len++;	/* for final paren */
+			if (--os->stackDepth > base)
+				len++;	/* for space after item */
+			continue;
+		}
+		os->stack[os->stackDepth - 1].iter = sexpIterNext(iter);
+		object = sexpIterObject(iter);
+		if (object == NULL)
+			continue;
+		if (isObjectString(object))
+			len += advancedLengthString(os, ((sexpString *) object)) + 1;
+		if (isObjectList(object)) {
+			len++;	/* for left paren */
+			pushOutputFrame(os, sexpListIter((sexpList *) object));
+		}
+	}
+	return len;
+}
+
+/* advancedListIsTooLong(os, list, layout)
+ * Returns true if the printed image of list, summarized by layout,
+ * is longer than the room left on the current line.
+ */
+int
+advancedListIsTooLong(sexpOutputStream *os, sexpList *list,
+	sexpListLayout *layout)
+{
+	long int room = os->maxcolumn - os->column;
+	if (layout->tokens == 0 || os->column < layout->minQuoted)
+		return layout->length > room;
+	if (os->column >= layout->maxQuoted)
+		return layout->length + 2 * layout->tokens > room;
+	if (layout->length > room)
+		return true;
+	if (layout->length + 2 * layout->tokens <= room)
+		return false;
+	/* the list is short: just measure it */
+	return advancedLengthListUpTo(os, list, room) > room;
+}
+
+/* advancedOpenList(os, list)
+ * Starts printing list, pushing a frame for walking it onto the stack.
  * Uses print-length to determine length of the image.  If it all fits
  * on the current line, then it is printed that way.  Otherwise, it is
  * written out in "vertical" mode, with items of the list starting in
  * the same column on successive lines.
  */
 void
-advancedPrintList(sexpOutputStream *os, sexpList *list)
+advancedOpenList(sexpOutputStream *os, sexpList *list)
 {
-	int vertical = false;
-	int firstelement = true;
-	sexpIter *iter;
-	sexpObject *object;
+	int vertical;
 	os->putChar(os, '(');
 	os->indent++;
-	if (advancedLengthList(os, list) > os->maxcolumn - os->column)
-		vertical = true;
-	iter = sexpListIter(list);
-	while (iter != NULL) {
+	vertical = advancedListIsTooLong(os, list, &os->layout[os->layoutNext++]);
+	pushOutputFrame(os, sexpListIter(list))->vertical = vertical;
+}
+
+/* advancedPrintItems(os, base)
+ * Prints the rest of the lists on the stack of os above frame base,
+ * innermost first, and closes them.
+ */
+void
+advancedPrintItems(sexpOutputStream *os, long int base)
+{
+	sexpOutputFrame *f;
+	sexpIter *iter;
+	sexpObject *object;
+	int first;
+	while (os->stackDepth > base) {
+		f = &os->stack[os->stackDepth - 1];
+		iter = f->iter;
+		if (iter == NULL) {
+			if (os->maxcolumn > 0 && os->column > os->maxcolumn - 2)
+				os->newLine(os, ADVANCED);
+			os->indent--;
+			os->putChar(os, ')');
+			os->stackDepth--;
+			continue;
+		}
+		f->iter = sexpIterNext(iter);
+		first = f->first;
+		f->first = false;
 		object = sexpIterObject(iter);
-		if (object != NULL) {
-			if (!firstelement) {
-				if (vertical)
-					os->newLine(os, ADVANCED);
-				else
-					os->putChar(os, ' ');
-			}
-			advancedPrintObject(os, object);
+		if (object == NULL)
+			continue;
+		if (!first) {
+			if (f->vertical)
+				os->newLine(os, ADVANCED);
+			else
+				os->putChar(os, ' ');
 		}
-		iter = sexpIterNext(iter);
-		firstelement = false;
+		if (os->maxcolumn > 0 && os->column > os->maxcolumn - 4)
+			os->newLine(os, ADVANCED);
+		if (isObjectString(object))
+			advancedPrintString(os, (sexpString *) object);
+		else if (isObjectList(object))
+			advancedOpenList(os, (sexpList *) object);
+		else
+			err(1, "%s", "NULL object can't be printed.");
 	}
-	if (os->maxcolumn > 0 && os->column > os->maxcolumn - 2)
-		os->newLine(os, ADVANCED);
-	os->indent--;
-	os->putChar(os, ')');
+}
+
+/* advancedPrintList(os, list)
+ * Prints out the list "list" onto output stream os.
+ */
+void
+advancedPrintList(sexpOutputStream *os, sexpList *list)
+{
+	long int base = os->stackDepth;
+	if (os->layoutNext >= os->layoutCount) {
+		/* not within an object being printed: lay this list out */
+		advancedLayoutObject(os, (sexpObject *) list);
+		advancedPrintList(os, list);
+		os->layoutCount = 0;
+		return;
+	}
+	advancedOpenList(os, list);
+	advancedPrintItems(os, base);
 }
 
 /* advancedPrintObject(os, object)
@@ -598,6 +1035,12 @@ advancedPrintList(sexpOutputStream *os, sexpList *list)
 void
 advancedPrintObject(sexpOutputStream *os, sexpObject *object)
 {
+	if (os->layoutNext >= os->layoutCount && isObjectList(object)) {
+		advancedLayoutObject(os, object);
+		advancedPrintObject(os, object);
+		os->layoutCount = 0;
+		return;
+	}
 	if (os->maxcolumn > 0 && os->column > os->maxcolumn - 4)
 		os->newLine(os, ADVANCED);
 	if (isObjectString(object))
@@ -0,0 +1,85 @@
+#include "sexp.h"
+
+/***********/
+/* QUERIES */
+/***********/
+
+/* A query picks subexpressions out of an object by a path of leading
+ * tokens, such as certificate/subject/public-key: the object itself
+ * must be a list beginning with certificate, and what is selected are
+ * the lists beginning with public-key within the lists beginning with
+ * subject within it.  A step of * matches any list.
+ *
+ * Only the lists on a matching path are looked into.  A lazy list
+ * (see newLazyList()) is matched on its leading token without being
+ * scanned, so the lists a query passes over are never parsed.  They
+ * are only measured, once, along with the list they are in, so that
+ * a query takes time in proportion to its input however deep it is.
+ */
+
+/* queryStepMatches(object, step, length)
+ * Returns whether object is a list matching the step of a query given
+ * by the length bytes at step.
+ */
+static int
+queryStepMatches(sexpObject *object, char *step, size_t length)
+{
+	sexpLazyList *lazy = (sexpLazyList *) object;
+	sexpObject *first;
+	sexpSimpleString *ss;
+	uint8_t *key;
+	size_t keyLength;
+	if (object == NULL || !isObjectList(object))
+		return false;
+	if (length == 1 && *step == '*')
+		return true;
+	if (objectType(object) == SEXP_LAZY_LIST && lazy->list == NULL) {
+		key = findObjectKey(lazy->bytes, 0, lazy->length, &keyLength);
+		if (key != NULL)
+			return keyLength == length && memcmp(key, step, length) == 0;
+		/* the leading string is in another form, so has to be scanned */
+	}
+	first = sexpIterObject(sexpListIter((sexpList *) object));
+	if (first == NULL || !isObjectString(first))
+		return false;
+	ss = sexpStringString((sexpString *) first);
+	return (size_t) simpleStringLength(ss) == length
+		&& memcmp(simpleStringString(ss), step, length) == 0;
+}
+
+/* queryObject(a, tail, object, path)
+ * Appends the subexpressions of object selected by path to the list
+ * whose last cell is tail, in arena a.  Returns the new last cell.
+ */
+static sexpList *
+queryObject(sexpArena *a, sexpList *tail, sexpObject *object, char *path)
+{
+	sexpIter *iter;
+	char *next = strchr(path, '/');
+	size_t length = next == NULL ? strlen(path) : (size_t) (next - path);
+	if (!queryStepMatches(object, path, length))
+		return tail;
+	if (next == NULL)
+		return sexpAppendSexpListObject(a, tail, object);
+	/* the leading string can't match a step, which must be a list */
+	iter = sexpIterNext(sexpListIter((sexpList *) object));
+	for (; iter != NULL; iter = sexpIterNext(iter))
+		tail = queryObject(a, tail, sexpIterObject(iter), next + 1);
+	return tail;
+}
+
+/* sexpQuery(a, object, path)
+ * Returns a list, allocated in arena a, of the subexpressions of
+ * object selected by path, in the order they come in object.
+ */
+sexpList *
+sexpQuery(sexpArena *a, sexpObject *object, char *path)
+{
+	sexpList *list;
+	list = newSexpList(a);
+	if (*path == '/')
+		path++;
+	queryObject(a, list, object, path);
+	closeSexpList(list);
+	return list;
+}
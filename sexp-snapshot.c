@@ -0,0 +1,401 @@
+#include "sexp.h"
+
+/*************/
+/* SNAPSHOTS */
+/*************/
+
+/* A snapshot is SNAPSHOTMAGIC and a byte of SNAPSHOTVERSION, then the
+ * items of each object in turn.  Each item is a number, written 7 bits
+ * to a byte, low bits first, with the top bit set in all but the last:
+ *	SNAPSHOT_OBJECT		begins an object
+ *	SNAPSHOT_OPEN		begins a list
+ *	SNAPSHOT_CLOSE		ends the list
+ *	SNAPSHOT_HINT		makes the string after it the presentation hint
+ *				of the one after that
+ *	SNAPSHOT_STRING + 3 * n + SNAPSHOT_BYTES
+ *				is a string of the n bytes after it
+ *	SNAPSHOT_STRING + 3 * n + SNAPSHOT_NEW
+ *				is the same, and shares the string
+ *	SNAPSHOT_STRING + 3 * n + SNAPSHOT_SHARED
+ *				is the same as shared string number n
+ * Strings are numbered from 0 as they are shared, through the whole
+ * snapshot, and a string is only written as the number of a shared one
+ * where that is shorter.  Lists take no more room than in canonical
+ * form, and strings no more either, so a snapshot takes no more room
+ * than the canonical forms of its objects, and a byte for each.
+ *
+ * Reading one back decodes the items of each object into the objects
+ * that parsing it would build, without looking at its bytes one by one
+ * as parsing does: the strings are borrowed from the mapped file.
+ */
+#define SNAPSHOT_OBJECT 0
+#define SNAPSHOT_OPEN 1
+#define SNAPSHOT_CLOSE 2
+#define SNAPSHOT_HINT 3
+#define SNAPSHOT_STRING 4
+#define SNAPSHOT_SHARED 0
+#define SNAPSHOT_NEW 1
+#define SNAPSHOT_BYTES 2
+
+/* newSexpSnapshotWriter(file)
+ * Creates a writer of a snapshot to file, and writes its header.
+ */
+sexpSnapshotWriter *
+newSexpSnapshotWriter(FILE *file)
+{
+	sexpSnapshotWriter *sw;
+	sw = malloc(sizeof (sexpSnapshotWriter));
+	if (sw == NULL)
+		err(1, "%s", "Can't allocate snapshot writer");
+	sw->file = file;
+	sw->sharedSize = 1024;
+	sw->shared = calloc(sw->sharedSize, sizeof (sexpSnapshotShared));
+	if (sw->shared == NULL)
+		err(1, "%s", "Can't allocate snapshot writer");
+	sw->sharedCount = 0;
+	sw->arena = newSexpArena();
+	fwrite(SNAPSHOTMAGIC, 1, sizeof SNAPSHOTMAGIC - 1, file);
+	putc(SNAPSHOTVERSION, file);
+	return sw;
+}
+
+/* numberLength(n)
+ * Returns the number of bytes n is written in.
+ */
+static size_t
+numberLength(size_t n)
+{
+	size_t length = 1;
+	for (; n >= 0x80; n >>= 7)
+		length++;
+	return length;
+}
+
+/* putSnapshotNumber(sw, n)
+ * Writes the number n to the snapshot of sw.
+ */
+static void
+putSnapshotNumber(sexpSnapshotWriter *sw, size_t n)
+{
+	for (; n >= 0x80; n >>= 7)
+		putc_unlocked((int) (n & 0x7F) | 0x80, sw->file);
+	putc_unlocked((int) n, sw->file);
+}
+
+/* sharedSlot(sw, bytes, n)
+ * Returns the slot of sw->shared for the n bytes at bytes: that of the
+ * same string, if it is shared already, or a free one.
+ */
+static sexpSnapshotShared *
+sharedSlot(sexpSnapshotWriter *sw, uint8_t *bytes, size_t n)
+{
+	sexpSnapshotShared *slot;
+	size_t i, mask = sw->sharedSize - 1;
+	for (i = hashAtomBytes(bytes, n) & mask;; i = (i + 1) & mask) {
+		slot = &sw->shared[i];
+		if (slot->bytes == NULL
+			|| (slot->length == n && memcmp(slot->bytes, bytes, n) == 0))
+			return slot;
+	}
+}
+
+/* growShared(sw)
+ * Doubles the number of slots of sw->shared, placing the strings in
+ * them again.
+ */
+static void
+growShared(sexpSnapshotWriter *sw)
+{
+	sexpSnapshotShared *old = sw->shared;
+	size_t i, oldSize = sw->sharedSize;
+	sw->sharedSize *= 2;
+	sw->shared = calloc(sw->sharedSize, sizeof (sexpSnapshotShared));
+	if (sw->shared == NULL)
+		outOfMemory(sw->arena, "snapshot strings");
+	for (i = 0; i < oldSize; i++)
+		if (old[i].bytes != NULL)
+			*sharedSlot(sw, old[i].bytes, old[i].length) = old[i];
+	free(old);
+}
+
+/* putSnapshotString(sw, ss)
+ * Writes simple string ss to the snapshot of sw, as the number of the
+ * same string if that is shared, and shorter, or else as its bytes,
+ * sharing it if it may come again.
+ */
+static void
+putSnapshotString(sexpSnapshotWriter *sw, sexpSimpleString *ss)
+{
+	uint8_t *bytes = simpleStringString(ss);
+	size_t n = simpleStringLength(ss);
+	size_t item = SNAPSHOT_STRING + 3 * n + SNAPSHOT_BYTES;
+	sexpSnapshotShared *slot;
+	/* a byte or two takes no more room than a number */
+	if (n > 1 && n <= MAXSHAREDLENGTH) {
+		slot = sharedSlot(sw, bytes, n);
+		if (slot->bytes != NULL && numberLength(SNAPSHOT_STRING
+				+ 3 * slot->number) < numberLength(item) + n) {
+			putSnapshotNumber(sw,
+				SNAPSHOT_STRING + 3 * slot->number + SNAPSHOT_SHARED);
+			return;
+		}
+		if (slot->bytes == NULL && sw->sharedCount < MAXSHARED) {
+			slot->bytes = arenaAllocate(sw->arena, n);
+			memcpy(slot->bytes, bytes, n);
+			slot->length = n;
+			slot->number = sw->sharedCount++;
+			item = SNAPSHOT_STRING + 3 * n + SNAPSHOT_NEW;
+			/* keep the table no more than half full */
+			if (sw->sharedCount > sw->sharedSize / 2)
+				growShared(sw);
+		}
+	}
+	putSnapshotNumber(sw, item);
+	if (n > 0)
+		fwrite(bytes, 1, n, sw->file);
+}
+
+/* writeSnapshotObject(sw, object)
+ * Writes object, of any kind, to the snapshot of sw.  Returns false if
+ * the snapshot can't be written.
+ */
+int
+writeSnapshotObject(sexpSnapshotWriter *sw, sexpObject *object)
+{
+	sexpIter **stack = NULL, **iters;
+	sexpSimpleString *hint;
+	long int stackSize = 0, depth = 0;
+	putSnapshotNumber(sw, SNAPSHOT_OBJECT);
+	for (;;) {
+		if (isObjectString(object)) {
+			hint = sexpStringPresentationHint((sexpString *) object);
+			if (hint != NULL) {
+				putSnapshotNumber(sw, SNAPSHOT_HINT);
+				putSnapshotString(sw, hint);
+			}
+			putSnapshotString(sw, sexpStringString((sexpString *) object));
+			if (depth > 0)
+				stack[depth - 1] = sexpIterNext(stack[depth - 1]);
+		} else {
+			if (depth == stackSize) {
+				stackSize = 16 + 2 * stackSize;
+				iters = realloc(stack, stackSize * sizeof (sexpIter *));
+				if (iters == NULL) {
+					free(stack);
+					outOfMemory(NULL, "snapshot stack");
+				}
+				stack = iters;
+			}
+			putSnapshotNumber(sw, SNAPSHOT_OPEN);
+			stack[depth++] = sexpListIter((sexpList *) object);
+		}
+		/* finish the lists with no more items */
+		while (depth > 0 && sexpIterObject(stack[depth - 1]) == NULL) {
+			putSnapshotNumber(sw, SNAPSHOT_CLOSE);
+			if (--depth > 0)
+				stack[depth - 1] = sexpIterNext(stack[depth - 1]);
+		}
+		if (depth == 0)
+			break;
+		object = sexpIterObject(stack[depth - 1]);
+	}
+	free(stack);
+	return !ferror(sw->file);
+}
+
+/* freeSexpSnapshotWriter(sw)
+ * Frees sw, once its snapshot is written.
+ */
+void
+freeSexpSnapshotWriter(sexpSnapshotWriter *sw)
+{
+	free(sw->shared);
+	freeSexpArena(sw->arena);
+	free(sw);
+}
+
+/* writeSnapshot(is, file)
+ * Writes a snapshot of all the objects of is to file.  Returns SEXP_OK,
+ * or the kind of error met reading them or writing the snapshot, in
+ * which case is->errorMessage says what it was.
+ */
+int
+writeSnapshot(sexpInputStream *is, FILE *file)
+{
+	sexpSnapshotWriter *sw;
+	sexpObject *object;
+	int code;
+	sw = newSexpSnapshotWriter(file);
+	while ((code = sexpParseObject(is, &object)) == SEXP_OK
+		&& writeSnapshotObject(sw, object))
+		releaseSexpArena(is->arena);
+	freeSexpSnapshotWriter(sw);
+	if (code != SEXP_OK && code != SEXP_EOF)
+		return code;
+	if (code == SEXP_EOF && fflush(file) == 0 && !ferror(file))
+		return SEXP_OK;
+	is->error = SEXP_ERR_OUTPUT;
+	is->errorOffset = is->count;
+	snprintf(is->errorMessage, sizeof (is->errorMessage),
+		"Can't write snapshot: %s.", strerror(errno));
+	return is->error;
+}
+
+/* getSnapshotNumber(is)
+ * Returns the number at is->position in the snapshot is reads, and
+ * moves past it.
+ */
+static size_t
+getSnapshotNumber(sexpInputStream *is)
+{
+	size_t n = 0;
+	unsigned int shift = 0;
+	uint8_t b;
+	do {
+		if (is->position == is->bufferLength)
+			sexpError(is, SEXP_ERR_SYNTAX, "%s",
+				"Snapshot ends within an object.");
+		if (shift >= CHAR_BIT * sizeof (size_t))
+			sexpError(is, SEXP_ERR_SYNTAX, "%s", "Bad number in snapshot.");
+		b = is->buffer[is->position++];
+		is->count++;
+		n |= (size_t) (b & 0x7F) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return n;
+}
+
+/* shareSnapshotString(is, bytes, n)
+ * Shares the string of the n bytes at bytes, in the snapshot is reads,
+ * giving it the next number.
+ */
+static void
+shareSnapshotString(sexpInputStream *is, uint8_t *bytes, size_t n)
+{
+	sexpSnapshotString *t;
+	if (is->snapshotStringsCount == MAXSHARED)
+		sexpError(is, SEXP_ERR_SYNTAX, "%s",
+			"Too many shared strings in snapshot.");
+	if (is->snapshotStringsCount == is->snapshotStringsSize) {
+		is->snapshotStringsSize = 1024 + 2 * is->snapshotStringsSize;
+		t = realloc(is->snapshotStrings,
+			is->snapshotStringsSize * sizeof (sexpSnapshotString));
+		if (t == NULL)
+			outOfMemory(is->arena, "snapshot strings");
+		is->snapshotStrings = t;
+	}
+	t = &is->snapshotStrings[is->snapshotStringsCount++];
+	t->bytes = bytes;
+	t->length = n;
+}
+
+/* getSnapshotString(is, a, item)
+ * Returns the simple string that item, just read from the snapshot is
+ * reads, stands for, in arena a, moving past its bytes.  The bytes are
+ * borrowed from the input, or are those of an atom if is->atoms is set.
+ */
+static sexpSimpleString *
+getSnapshotString(sexpInputStream *is, sexpArena *a, size_t item)
+{
+	sexpSimpleString *ss;
+	uint8_t *bytes;
+	size_t n, kind;
+	if (item < SNAPSHOT_STRING)
+		sexpError(is, SEXP_ERR_SYNTAX, "%s", "Bad item in snapshot.");
+	n = (item - SNAPSHOT_STRING) / 3;
+	kind = (item - SNAPSHOT_STRING) % 3;
+	if (kind == SNAPSHOT_SHARED) {
+		if (n >= is->snapshotStringsCount)
+			sexpError(is, SEXP_ERR_SYNTAX, "%s",
+				"Bad shared string in snapshot.");
+		bytes = is->snapshotStrings[n].bytes;
+		n = is->snapshotStrings[n].length;
+	} else {
+		if (n > is->bufferLength - is->position)
+			sexpError(is, SEXP_ERR_SYNTAX, "%s",
+				"Snapshot ends within a string.");
+		bytes = is->buffer + is->position;
+		is->position += n;
+		is->count += n;
+		if (kind == SNAPSHOT_NEW)
+			shareSnapshotString(is, bytes, n);
+	}
+	if (is->atoms != NULL && (ss = internAtom(is->atoms, bytes, n)) != NULL)
+		return ss;
+	if (n == 0)
+		return newSimpleString(a);
+	ss = arenaAllocate(a, sizeof (sexpSimpleString));
+	ss->arena = a;
+	borrowSimpleString(ss, bytes, n);
+	return ss;
+}
+
+/* scanSnapshotObject(is)
+ * Returns the next object of the snapshot is reads, built as parsing
+ * it would build it, or NULL if there are no more.  The input must be
+ * mapped, and is->nextChar the first byte of the object, or of the
+ * snapshot.
+ */
+sexpObject *
+scanSnapshotObject(sexpInputStream *is)
+{
+	sexpTreeBuilder *tb = is->builder->data;
+	sexpEventSink *sink = is->builder;
+	sexpString *s;
+	size_t item, n = sizeof SNAPSHOTMAGIC - 1;
+	long int base = is->depth;
+	if (!is->mapped || is->byteSize != 8 || is->getChar != getChar
+		|| is->position == 0)
+		sexpError(is, SEXP_ERR_INPUT, "%s", "A snapshot must be mapped.");
+	/* go back to the byte in is->nextChar */
+	is->position--;
+	is->count--;
+	if (is->position == 0) {
+		if (is->bufferLength <= n || memcmp(is->buffer, SNAPSHOTMAGIC, n) != 0)
+			sexpError(is, SEXP_ERR_SYNTAX, "%s", "Input is not a snapshot.");
+		if (is->buffer[n] != SNAPSHOTVERSION)
+			sexpError(is, SEXP_ERR_SYNTAX, "%s",
+				"Snapshot was written by another version.");
+		is->position = n + 1;
+		is->count += n + 1;
+		if (is->position == is->bufferLength) {
+			is->getChar(is);
+			return NULL;
+		}
+	}
+	if (getSnapshotNumber(is) != SNAPSHOT_OBJECT)
+		sexpError(is, SEXP_ERR_SYNTAX, "%s", "Bad object in snapshot.");
+	if (is->tapes)
+		sink = tapeSink(is);
+	else
+		tb->depth = 0;
+	do {
+		item = getSnapshotNumber(is);
+		if (item == SNAPSHOT_OPEN) {
+			if (is->maxDepth >= 0 && is->depth >= is->maxDepth)
+				sexpError(is, SEXP_ERR_DEPTH,
+					"Lists nested more than %ld deep.", is->maxDepth);
+			sink->openList(sink);
+			is->depth++;
+			SEXP_COUNT(is->stats, lists, 1);
+			SEXP_MAX(is->stats, depth, is->depth);
+		} else if (item == SNAPSHOT_CLOSE && is->depth > base) {
+			sink->closeList(sink);
+			is->depth--;
+		} else {
+			s = newSexpString(sink->arena);
+			if (item == SNAPSHOT_HINT) {
+				setSexpStringPresentationHint(s,
+					getSnapshotString(is, sink->arena, getSnapshotNumber(is)));
+				item = getSnapshotNumber(is);
+			}
+			setSexpStringString(s, getSnapshotString(is, sink->arena, item));
+			SEXP_COUNT(is->stats, strings, 1);
+			sink->string(sink, s);
+		}
+	} while (is->depth > base);
+	is->getChar(is);
+	if (is->tapes)
+		return ((sexpTapeBuilder *) sink->data)->object;
+	return tb->object;
+}
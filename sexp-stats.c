@@ -0,0 +1,186 @@
+#include "sexp.h"
+
+/**************/
+/* STATISTICS */
+/**************/
+
+/* A sexpStats counts the work done by the input streams, output streams
+ * and arenas that are given it, and keeps the wall time spent in each
+ * phase of the work.  The clock is read only as a phase begins or ends,
+ * so allocation is timed only where it goes to malloc() for a block.
+ * Bytes are counted by the encoding region they are in: those of hex
+ * and base64 regions as they are in the input, and the rest as the
+ * difference.  What is decoded again within a {...} region is not
+ * input, and is counted only as objects, lists and strings.
+ */
+
+static const char *phaseNames[SEXP_PHASES] = {
+	"other", "read", "scan", "decode", "allocate", "print"
+};
+
+/* statsClock()
+ * Returns the time in seconds from some fixed moment.
+ */
+static double
+statsClock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* newSexpStats()
+ * Creates a sexpStats with nothing counted, timing from now.
+ */
+sexpStats *
+newSexpStats()
+{
+	sexpStats *stats;
+	stats = calloc(1, sizeof (sexpStats));
+	if (stats == NULL)
+		err(1, "%s", "Can't allocate statistics");
+	stats->phase = SEXP_PHASE_OTHER;
+	stats->phaseStart = statsClock();
+	return stats;
+}
+
+/* enterPhase(stats, phase)
+ * Adds the time since the phase under way began to it, and begins phase.
+ * Returns the phase that was under way.
+ */
+int
+enterPhase(sexpStats *stats, int phase)
+{
+	double now = statsClock();
+	int previous = stats->phase;
+	stats->seconds[previous] += now - stats->phaseStart;
+	stats->phaseStart = now;
+	stats->phase = phase;
+	return previous;
+}
+
+/* inputOffset(is)
+ * Returns the offset in the input of is->nextChar, or of the end of the
+ * input at EOF.
+ */
+static long int
+inputOffset(sexpInputStream *is)
+{
+	return is->stats->inputBase + is->position - (is->nextChar != EOF);
+}
+
+/* beginObjectStats(is)
+ * Marks the start of an object read by is, at is->nextChar, and begins
+ * scanning it.
+ */
+void
+beginObjectStats(sexpInputStream *is)
+{
+	sexpStats *stats = is->stats;
+	stats->objectStart = inputOffset(is);
+	stats->depth = 0;
+	stats->objectPhase = enterPhase(stats, SEXP_PHASE_SCAN);
+}
+
+/* endObjectStats(is)
+ * Counts the object read by is since beginObjectStats(), and goes back
+ * to the phase under way before it.
+ */
+void
+endObjectStats(sexpInputStream *is)
+{
+	sexpStats *stats = is->stats;
+	stats->objects++;
+	/* the bytes of hex and base64 regions were taken off as they came */
+	stats->bytesIn[SEXP_REGION(8)] += inputOffset(is) - stats->objectStart;
+	if (stats->depth > stats->maxDepth)
+		stats->maxDepth = stats->depth;
+	enterPhase(stats, stats->objectPhase);
+}
+
+/* addSexpStats(total, stats)
+ * Adds the counts and times of stats to those of total.
+ */
+void
+addSexpStats(sexpStats *total, sexpStats *stats)
+{
+	int i;
+	enterPhase(stats, stats->phase);
+	total->objects += stats->objects;
+	total->lists += stats->lists;
+	total->strings += stats->strings;
+	total->cells += stats->cells;
+	total->allocations += stats->allocations;
+	total->allocatedBytes += stats->allocatedBytes;
+	total->blocks += stats->blocks;
+	if (stats->maxDepth > total->maxDepth)
+		total->maxDepth = stats->maxDepth;
+	for (i = 0; i < SEXP_REGIONS; i++) {
+		total->bytesIn[i] += stats->bytesIn[i];
+		total->bytesOut[i] += stats->bytesOut[i];
+	}
+	for (i = 0; i < SEXP_PHASES; i++)
+		total->seconds[i] += stats->seconds[i];
+}
+
+/* printBytes(file, what, bytes)
+ * Prints a line of the number of bytes of each region in bytes.
+ */
+static void
+printBytes(FILE *file, char *what, long int *bytes)
+{
+	fprintf(file, "%-14s%ld (8-bit %ld, hex %ld, base64 %ld)\n", what,
+		bytes[0] + bytes[1] + bytes[2], bytes[SEXP_REGION(8)],
+		bytes[SEXP_REGION(4)], bytes[SEXP_REGION(6)]);
+}
+
+/* printSexpStats(stats, file)
+ * Prints a summary of what stats has counted to file.
+ */
+void
+printSexpStats(sexpStats *stats, FILE *file)
+{
+	double total = 0;
+	int i;
+	enterPhase(stats, stats->phase);
+	fprintf(file, "%-14s%ld\n", "objects", stats->objects);
+	fprintf(file, "%-14s%ld\n", "lists", stats->lists);
+	fprintf(file, "%-14s%ld\n", "strings", stats->strings);
+	fprintf(file, "%-14s%ld\n", "list cells", stats->cells);
+	fprintf(file, "%-14s%ld\n", "max depth", stats->maxDepth);
+	fprintf(file, "%-14s%ld (%ld bytes, %ld blocks)\n", "allocations",
+		stats->allocations, stats->allocatedBytes, stats->blocks);
+	printBytes(file, "bytes in", stats->bytesIn);
+	printBytes(file, "bytes out", stats->bytesOut);
+	for (i = 0; i < SEXP_PHASES; i++)
+		total += stats->seconds[i];
+	fprintf(file, "%-14s%.6f (", "seconds", total);
+	for (i = 0; i < SEXP_PHASES; i++)
+		fprintf(file, "%s%s %.6f", i > 0 ? ", " : "", phaseNames[i],
+			stats->seconds[i]);
+	fprintf(file, ")\n");
+}
+
+/* printSexpObjectStats(stats, previous, file)
+ * Prints a line to file of what stats has counted since previous, for
+ * the object just read and printed, and copies stats to previous.
+ */
+void
+printSexpObjectStats(sexpStats *stats, sexpStats *previous, FILE *file)
+{
+	long int in = 0, out = 0;
+	int i;
+	enterPhase(stats, stats->phase);
+	for (i = 0; i < SEXP_REGIONS; i++) {
+		in += stats->bytesIn[i] - previous->bytesIn[i];
+		out += stats->bytesOut[i] - previous->bytesOut[i];
+	}
+	fprintf(file, "object %ld at %ld: %ld bytes in, %ld out, %ld lists, "
+		"%ld strings, depth %ld, %ld allocations, scan %.6f s, print %.6f s\n",
+		stats->objects, stats->objectStart, in, out,
+		stats->lists - previous->lists, stats->strings - previous->strings,
+		stats->depth, stats->allocations - previous->allocations,
+		stats->seconds[SEXP_PHASE_SCAN] - previous->seconds[SEXP_PHASE_SCAN],
+		stats->seconds[SEXP_PHASE_PRINT] - previous->seconds[SEXP_PHASE_PRINT]);
+	*previous = *stats;
+}
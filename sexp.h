@@ -3,13 +3,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef SEXP_H
 #define SEXP_H
 
 #define DEFAULTLINELENGTH 75
+#define INPUTBUFFERSIZE 65536
+#define OUTPUTBUFFERSIZE 65536
+#define ENCODEBUFFERSIZE 4096
+#define DECODEBUFFERSIZE 4096
+#define ERRORMESSAGESIZE 128
+#define BATCHJOBSIZE 65536
+#define MAXATOMLENGTH 16	/* longest string kept in an atom table */
+#define MAXATOMS 4096		/* most strings kept in an atom table */
+#define SNAPSHOTMAGIC "SEXPSNAP"
+#define SNAPSHOTVERSION 1
+#define MAXSHAREDLENGTH 256	/* longest string shared in a snapshot */
+#define MAXSHARED 1048576	/* most strings shared in a snapshot */
+#define SEXP_MAXDIGESTSIZE 32	/* bytes in the longest digest */
 
 /* PRINTING MODES */
 enum Mode {
@@ -18,22 +40,164 @@ enum Mode {
 	ADVANCED		/* Pretty-printed */
 };
 
+/* HASH ALGORITHMS, for hashes of canonical forms */
+enum HashAlgorithm {
+	SEXP_SHA1=1,
+	SEXP_SHA256
+};
+
+/* PHASES OF WORK, whose times are kept in a sexpStats */
+enum Phase {
+	SEXP_PHASE_OTHER=0,		/* none of the others */
+	SEXP_PHASE_READ,		/* reading input */
+	SEXP_PHASE_SCAN,		/* scanning and building objects */
+	SEXP_PHASE_DECODE,		/* decoding hex and base64 regions */
+	SEXP_PHASE_ALLOCATE,	/* getting arena blocks from malloc() */
+	SEXP_PHASE_PRINT,		/* printing objects */
+	SEXP_PHASES
+};
+
+/* ENCODING REGIONS, numbered from their byte sizes: 4 is hex, 6 base64
+ * and 8 plain 8-bit */
+#define SEXP_REGION(byteSize) (((byteSize) - 4) / 2)
+#define SEXP_REGIONS 3
+
+/* CHARACTER CLASSES, the bits of charClass[c] */
+#define SEXP_WHITESPACE 0x01	/* blank, \t, \n, \v, \f or \r */
+#define SEXP_DECDIGIT 0x02		/* 0-9 */
+#define SEXP_HEXDIGIT 0x04		/* 0-9A-Fa-f */
+#define SEXP_BASE64DIGIT 0x08	/* A-Za-z0-9+/ */
+#define SEXP_TOKENCHAR 0x10		/* can be in a token */
+#define SEXP_ALPHA 0x20			/* A-Za-z */
+#define SEXP_STRUCTURAL 0x40	/* ()"|#{[ or 0-9, see findStructural() */
+
+/* classes of c, which may be EOF */
+#define CHARCLASS(c) ((unsigned int) (c) < 256 ? charClass[c] : 0)
+
+/* RESULTS OF PARSING, from sexpParseObject() */
+enum Error {
+	SEXP_OK=0,
+	SEXP_EOF,			/* no more objects */
+	SEXP_ERR_SYNTAX,	/* input is not a well-formed S-expression */
+	SEXP_ERR_DEPTH,		/* lists nested more deeply than allowed */
+	SEXP_ERR_MEMORY,	/* out of memory */
+	SEXP_ERR_INPUT,		/* input can't be read */
+	SEXP_ERR_OUTPUT		/* output can't be written */
+};
+
 /* TYPES OF OBJECTS */
 enum ObjectType {
 	SEXP_STRING=1,
-	SEXP_LIST
+	SEXP_LIST,
+	SEXP_TAPE_STRING,	/* a string of a tape */
+	SEXP_TAPE_LIST,		/* a list of a tape */
+	SEXP_LAZY_LIST		/* a list not scanned yet */
 };
+#define SEXP_TAPE_LAST 0x10	/* in the type of the last item of a list */
+/* type of an object of either kind, and whether it is part of a tape */
+#define objectType(p) (((sexpTapeNode *) (p))->type & ~SEXP_TAPE_LAST)
+#define isTapeNode(p) (objectType(p) == SEXP_TAPE_STRING \
+	|| objectType(p) == SEXP_TAPE_LIST)
+
+/* Counts of the work done by the streams and arenas given a sexpStats,
+ * see sexp-stats.c */
+typedef struct sexpStats {
+	long int objects;		/* objects read */
+	long int lists;			/* lists scanned */
+	long int strings;		/* strings scanned */
+	long int cells;			/* list cells allocated */
+	long int allocations;	/* arena allocations */
+	long int allocatedBytes;	/* bytes of them */
+	long int blocks;		/* arena blocks got from malloc() */
+	long int maxDepth;		/* deepest nesting of lists scanned */
+	long int bytesIn[SEXP_REGIONS];		/* bytes of objects read, by region */
+	long int bytesOut[SEXP_REGIONS];	/* bytes printed, by region */
+	double seconds[SEXP_PHASES];	/* wall time spent in each phase */
+	int phase;				/* phase under way */
+	double phaseStart;		/* when it began */
+	int objectPhase;		/* phase under way before the object began */
+	long int objectStart;	/* offset of the object being read */
+	long int depth;			/* deepest nesting of lists in it */
+	long int inputBase;		/* offset of the input buffer in the input */
+} sexpStats;
+
+/* Counting into stats costs a test where stats is NULL, and nothing at
+ * all when built with -DSEXP_NO_STATS.  SEXP_ENTER() begins a phase and
+ * returns the one under way, for SEXP_LEAVE() to go back to. */
+#ifdef SEXP_NO_STATS
+#define SEXP_COUNT(stats, field, n) ((void) 0)
+#define SEXP_MAX(stats, field, n) ((void) 0)
+#define SEXP_ENTER(stats, phase) SEXP_PHASE_OTHER
+#define SEXP_LEAVE(stats, phase) ((void) (phase))
+#define SEXP_BEGIN_OBJECT(is) ((void) 0)
+#define SEXP_END_OBJECT(is) ((void) 0)
+#else
+#define SEXP_COUNT(stats, field, n) \
+	((stats) != NULL ? (void) ((stats)->field += (n)) : (void) 0)
+#define SEXP_MAX(stats, field, n) ((stats) != NULL && (n) > (stats)->field \
+	? (void) ((stats)->field = (n)) : (void) 0)
+#define SEXP_ENTER(stats, phase) \
+	((stats) != NULL ? enterPhase(stats, phase) : SEXP_PHASE_OTHER)
+#define SEXP_LEAVE(stats, phase) \
+	((stats) != NULL ? (void) enterPhase(stats, phase) : (void) 0)
+#define SEXP_BEGIN_OBJECT(is) \
+	((is)->stats != NULL ? beginObjectStats(is) : (void) 0)
+#define SEXP_END_OBJECT(is) \
+	((is)->stats != NULL ? endObjectStats(is) : (void) 0)
+#endif
 
+/* A block of arena storage; the usable bytes follow the header */
+typedef struct sexpArenaBlock {
+	struct sexpArenaBlock *next;
+	size_t size;				/* usable bytes in this block */
+	size_t used;				/* bytes handed out so far */
+} sexpArenaBlock;
+
+typedef struct sexpArena {
+	sexpArenaBlock *blocks;		/* current block first */
+	sexpArenaBlock *lastBlock;	/* block holding the last allocation */
+	void *last;					/* last allocation, which may grow in place */
+	jmp_buf *onError;			/* where to go when out of memory, or NULL */
+	sexpStats *stats;			/* where allocations are counted, or NULL */
+} sexpArena;
+
+/* allocatedLength is negative when string is borrowed from storage
+ * the simple string doesn't own, such as a mapped input file */
 typedef struct sexpSimpleString {
 	long int length;
 	long int allocatedLength;
+	sexpArena *arena;			/* where string is allocated, or NULL */
 	uint8_t *string;
 } sexpSimpleString;
 
+/* A set of short simple strings, each kept once, see internAtom() */
+typedef struct sexpAtomTable {
+	sexpArena *arena;			/* where the atoms are allocated */
+	sexpSimpleString **slots;	/* atoms by hash of their bytes, or NULL */
+	size_t size;				/* number of slots, a power of 2 */
+	size_t count;				/* number of atoms */
+} sexpAtomTable;
+
+/* Hashes of an object, kept with it once computed by sexpHashTree()
+ * or sexpObjectDigest().  The cache of a list is shared by all its
+ * cells, and changing the object through the basic routines marks the
+ * caches from its own up to that of the object at the top out of date.
+ */
+typedef struct sexpHashCache {
+	int valid;				/* length and parent are up to date */
+	int treeAlgorithm;		/* algorithm of tree, or 0 if out of date */
+	int digestAlgorithm;	/* algorithm of digest, or 0 if out of date */
+	long int length;		/* length of the canonical form */
+	struct sexpHashCache *parent;	/* of the list it is in, or NULL */
+	uint8_t tree[SEXP_MAXDIGESTSIZE];	/* Merkle digest */
+	uint8_t digest[SEXP_MAXDIGESTSIZE];	/* digest of the canonical form */
+} sexpHashCache;
+
 typedef struct sexpString {
 	enum ObjectType type;
 	sexpSimpleString *presentationHint;
 	sexpSimpleString *string;
+	sexpHashCache *cache;		/* its hashes, or NULL */
 } sexpString;
 
 /* If first is NULL, then rest must also be NULL; this is empty list */
@@ -41,6 +205,7 @@ typedef struct sexpList {
 	enum ObjectType type;
 	union sexpObject *first;
 	struct sexpList *rest;
+	sexpHashCache *cache;		/* hashes of the list, or NULL */
 } sexpList;
 
 /* Allows a pointer to something of either type */
@@ -49,25 +214,142 @@ typedef union sexpObject {
 	sexpList list;
 } sexpObject;
 
+/* A tape holds a whole object in one block of storage that can be
+ * moved: a list is a node followed by the nodes of its items, and a
+ * string is a node followed by its string and presentation hint, as
+ * sexpTapeStrings.  Their bytes come after all the nodes.  A pointer
+ * to a node can be used as a sexpObject, and a pointer to a
+ * sexpTapeString as a sexpSimpleString, with the accessors. */
+typedef struct sexpTapeNode {
+	uint32_t type;			/* SEXP_TAPE_LIST or SEXP_TAPE_STRING, and
+							 * SEXP_TAPE_LAST if last item of its list */
+	uint32_t size;			/* nodes from this one to the one after it */
+} sexpTapeNode;
+
+/* length is negative to tell it from a sexpSimpleString */
+typedef struct sexpTapeString {
+	long int length;		/* -1 - number of bytes */
+	long int offset;		/* offset of the bytes from this string */
+} sexpTapeString;
+
 /* an "iterator" for going over lists */
 /* In this implementation, it is the same as a list */
 typedef sexpList sexpIter;
 
+/* The extent of a list met by findObjectEnd() when measuring a lazy
+ * list, kept so that the lists within it need not be measured again.
+ * They are kept in the order the lists begin, each list's own first. */
+typedef struct sexpListExtent {
+	size_t length;			/* bytes of the list, from ( to ) */
+	size_t lists;			/* number of lists within it, at any depth */
+} sexpListExtent;
+
+/* A string of a snapshot that later ones refer to, where it lies in
+ * the input */
+typedef struct sexpSnapshotString {
+	uint8_t *bytes;
+	size_t length;
+} sexpSnapshotString;
+
 typedef struct sexpInputStream {
 	int nextChar;		/* character currently being scanned */
 	int byteSize;		/* 4 or 6 or 8 == currently scanning mode */
 	int bits;			/* Bits waiting to be used */
 	int nBits;			/* number of such bits waiting to be used */
 	void (*getChar)();
-	int count;			/* number of 8-bit characters output by getChar */
+	long int count;		/* number of 8-bit characters output by getChar */
 	FILE *inputFile;	/* where to get input, if not stdin */
+	uint8_t *buffer;	/* block of raw input being scanned */
+	size_t bufferLength;	/* number of bytes of input in buffer */
+	size_t position;	/* index of next unscanned byte in buffer */
+	int mapped;			/* buffer holds all remaining input and stays put */
+	size_t mapLength;	/* length of mapping of input file, or 0 */
+	sexpArena *arena;	/* where scanned objects are allocated */
+	struct sexpEventSink *builder;	/* builds objects for scanObject() */
+	struct sexpEventSink *tapeBuilder;	/* builds tapes for scanTape() */
+	int tapes;			/* scanObject() builds tapes */
+	int lazy;			/* scanObject() leaves lists to be scanned later */
+	sexpListExtent *extents;	/* those found measuring a lazy list */
+	size_t extentsSize;	/* number of them allocated */
+	size_t extentsCount;	/* number of them found */
+	sexpListExtent *nextExtent;	/* that of the next list to be left for
+								 * later, or NULL if it must be measured */
+	size_t extentsLeft;	/* number of them left in the list being scanned */
+	sexpAtomTable *atoms;	/* where short strings are kept, or NULL */
+	int snapshot;		/* input is a snapshot, see scanSnapshotObject() */
+	sexpSnapshotString *snapshotStrings;	/* those it shares so far */
+	size_t snapshotStringsSize;	/* number of them allocated */
+	size_t snapshotStringsCount;	/* number of them read */
+	long int depth;		/* number of lists open */
+	long int maxDepth;	/* most lists that may be open, or -1 if no maximum */
+	sexpStats *stats;	/* where what is read is counted, or NULL */
+	jmp_buf *onError;	/* where errors go, or NULL to exit with err() */
+	int error;			/* SEXP_OK, or the kind of error met */
+	long int errorOffset;	/* value of count when it was met */
+	char errorMessage[ERRORMESSAGESIZE];
 } sexpInputStream;
 
+/* A list whose items are scanned out of its bytes in the input only
+ * when they are first wanted, by sexpListIter().  The bytes must stay
+ * put until then, so lists are only left unscanned in mapped input. */
+typedef struct sexpLazyList {
+	enum ObjectType type;	/* SEXP_LAZY_LIST */
+	uint8_t *bytes;			/* the list, from ( to ) */
+	size_t length;			/* number of bytes of it */
+	long int offset;		/* value of count at its ( */
+	long int depth;			/* number of lists it is in, with itself */
+	sexpInputStream *is;	/* stream it was read from */
+	sexpListExtent *extents;	/* its extent and those of the lists in it */
+	sexpList *list;			/* its items, once scanned, or NULL */
+} sexpLazyList;
+
+/* State of a hash of the bytes given it so far, and, while it hashes
+ * what an output stream prints, the output functions it replaced */
+typedef struct sexpHash {
+	int algorithm;			/* SEXP_SHA1 or SEXP_SHA256 */
+	uint32_t state[8];
+	uint8_t block[64];		/* bytes waiting for a whole block */
+	size_t blockLength;		/* number of them */
+	uint64_t length;		/* number of bytes hashed */
+	void (*blocks)();		/* adds whole blocks to state */
+	void (*putChar)();
+	void (*putBytes)();
+} sexpHash;
+
+/* A list being walked by sexpHashTree(), and the hash of the digests
+ * of its items so far */
+typedef struct sexpHashFrame {
+	sexpIter *iter;			/* next item */
+	sexpHashCache *cache;	/* where its hashes go */
+	sexpHash hash;
+} sexpHashFrame;
+
+/* Summary of the printed image of a list, for the advanced printer.
+ * Strings that can be printed as tokens are counted as tokens in
+ * length; each of them takes 2 more characters, as a quoted string,
+ * when measured from a column at or past its own break column. */
+typedef struct sexpListLayout {
+	long int length;		/* length of image with all tokens as tokens */
+	long int tokens;		/* number of such tokens */
+	long int minQuoted;		/* least column at which one is quoted */
+	long int maxQuoted;		/* greatest column at which one is quoted */
+} sexpListLayout;
+
+/* A list being walked by the printers, which keep a stack of these in
+ * the output stream instead of recursing */
+typedef struct sexpOutputFrame {
+	sexpIter *iter;			/* rest of the list */
+	long int layout;		/* index of summary of the list */
+	int vertical;			/* items are printed on separate lines */
+	int first;				/* no item printed yet */
+} sexpOutputFrame;
+
 typedef struct sexpOutputStream {
 	long int column;		/* column where next character will go */
 	long int maxcolumn;		/* max usable column, or -1 if no maximum */
 	long int indent;		/* current indentation level (starts at 0) */
 	void (*putChar)();		/* output a character */
+	void (*putBytes)();		/* output a run of characters */
 	void (*newLine)();		/* go to next line (and indent) */
 	int byteSize;			/* 4 or 6 or 8 depending on output mode */
 	int bits;				/* bits waiting to go out */
@@ -75,17 +357,160 @@ typedef struct sexpOutputStream {
 	long int base64Count;	/* number of hex or base64 chars printed in this region */
 	enum Mode mode;
 	FILE *outputFile;		/* where to put output, if not stdout */
+	sexpListLayout *layout;	/* summaries of lists being printed */
+	long int layoutSize;	/* number of summaries allocated */
+	long int layoutCount;	/* number of summaries computed */
+	long int layoutNext;	/* summary of next list to be printed */
+	sexpOutputFrame *stack;	/* lists being walked, innermost last */
+	long int stackSize;		/* number of frames allocated */
+	long int stackDepth;	/* number of frames in use */
+	sexpHash *hash;			/* where output goes instead, or NULL */
+	sexpStats *stats;		/* where what is printed is counted, or NULL */
 } sexpOutputStream;
 
+/* Receives the objects scanned by scanEvents() as a series of events,
+ * without their being built.  Strings are allocated in arena, which
+ * the sink may release once it is done with them. */
+typedef struct sexpEventSink {
+	void (*openList)();		/* a list begins */
+	void (*closeList)();	/* the innermost open list ends */
+	void (*string)();		/* a string, with its presentation hint */
+	sexpArena *arena;		/* where strings are allocated */
+	void *data;				/* for use by the sink */
+} sexpEventSink;
+
+/* A list being built by the tree builder, and its last cell */
+typedef struct sexpBuildFrame {
+	sexpList *list;
+	sexpList *tail;
+} sexpBuildFrame;
+
+/* State of the tree builder event sink */
+typedef struct sexpTreeBuilder {
+	sexpBuildFrame *stack;	/* lists being built, innermost last */
+	long int size;			/* number of frames allocated */
+	long int depth;			/* number of frames in use */
+	sexpObject *object;		/* object built, once it is complete */
+} sexpTreeBuilder;
+
+/* A list being built by the tape builder, and its last item */
+typedef struct sexpTapeFrame {
+	long int list;			/* index of the node of the list */
+	long int last;			/* index of the node of its last item, or -1 */
+} sexpTapeFrame;
+
+/* State of the tape builder event sink.  The bytes of the strings are
+ * gathered apart from the nodes until the tape is complete. */
+typedef struct sexpTapeBuilder {
+	sexpTapeNode *nodes;	/* nodes of the tape being built */
+	long int size;			/* number of nodes allocated */
+	long int count;			/* number of nodes in use */
+	uint8_t *bytes;			/* bytes of its strings */
+	size_t bytesSize;		/* number of bytes allocated */
+	size_t bytesCount;		/* number of bytes in use */
+	sexpTapeFrame *stack;	/* lists being built, innermost last */
+	long int stackSize;		/* number of frames allocated */
+	long int depth;			/* number of frames in use */
+	sexpArena *objects;		/* where complete tapes are put */
+	sexpObject *object;		/* tape built, once it is complete */
+} sexpTapeBuilder;
+
+/* A snapshot holds objects already parsed, for them to be read back
+ * without being parsed again, in a form that is no larger than their
+ * canonical forms, and often much smaller: see sexp-snapshot.c.  A
+ * string met again is written as the number of its first copy. */
+
+/* A string shared in a snapshot being written, by the number later
+ * ones refer to it by */
+typedef struct sexpSnapshotShared {
+	uint8_t *bytes;			/* its bytes, or NULL if the slot is free */
+	size_t length;			/* number of them */
+	size_t number;			/* its number, from 0 */
+} sexpSnapshotShared;
+
+/* State of a snapshot being written */
+typedef struct sexpSnapshotWriter {
+	FILE *file;
+	sexpSnapshotShared *shared;	/* strings shared, by hash of their bytes */
+	size_t sharedSize;		/* number of slots of shared, a power of 2 */
+	size_t sharedCount;		/* number of strings shared */
+	sexpArena *arena;		/* where their bytes are kept */
+} sexpSnapshotWriter;
+
+/* A run of whole objects handed to a batch worker, and what it printed */
+typedef struct sexpBatchJob {
+	uint8_t *input;			/* the objects, as read */
+	size_t length;			/* number of bytes of them */
+	uint8_t *copy;			/* input, if it must be freed, or NULL */
+	long int offset;		/* offset of input in the whole input */
+	char *output;			/* what was printed, from open_memstream() */
+	size_t outputLength;	/* number of bytes printed */
+	int error;				/* SEXP_OK, or the kind of error met */
+	char errorMessage[ERRORMESSAGESIZE];
+	int done;				/* a worker has finished with it */
+} sexpBatchJob;
+
+/* State shared by the main thread and the workers in batch mode.
+ * Jobs are taken from a ring in input order: those from written to
+ * started are being worked on or wait to be written, and those from
+ * started to queued wait for a worker. */
+typedef struct sexpBatch {
+	pthread_mutex_t lock;
+	pthread_cond_t queuedJob;	/* signalled when a job is queued */
+	pthread_cond_t doneJob;		/* signalled when a job is done */
+	sexpBatchJob *jobs;		/* the ring */
+	long int size;			/* number of jobs in the ring */
+	long int written;		/* number of jobs written out */
+	long int started;		/* number of jobs given to workers */
+	long int queued;		/* number of jobs queued */
+	int finished;			/* no more jobs will be queued */
+	sexpOutputStream *os;	/* where the output of jobs is written */
+	bool copyInput;			/* jobs need a copy of their input */
+	bool canonical, base64, advanced;	/* output formats */
+	bool tapes;				/* objects are parsed into tapes */
+	bool lazy;				/* lists are scanned only when needed */
+	bool atoms;				/* short strings are kept in atom tables */
+	char *query;			/* path selecting what is printed, or NULL */
+	int hash;				/* algorithm of hashes printed, or 0 */
+	long int maxcolumn;		/* line width of output */
+	long int maxDepth;		/* deepest nesting of lists allowed */
+	sexpStats *stats;		/* where the workers add their counts, or NULL */
+} sexpBatch;
+
+/* An index of the objects of an input, being written or read, and
+ * the entry last written or read */
+typedef struct sexpIndex {
+	FILE *file;				/* where the index is */
+	long int record;		/* record number of the object, from 1 */
+	long int offset;		/* offset of the object in the input */
+	long int length;		/* length of the object in bytes */
+	char *key;				/* its key, or "" if it has none */
+	char *line;				/* the entry read, from getline() */
+	size_t lineSize;		/* bytes allocated for line */
+	char errorMessage[ERRORMESSAGESIZE];	/* why reading it failed, or "" */
+} sexpIndex;
+
 /* Function prototypes */
 
 /* sexp-basic */
 void initializeMemory();
+sexpArena *newSexpArena();
+void *arenaAllocate();
+void *arenaReallocate();
+void releaseSexpArena();
+void freeSexpArena();
+void outOfMemory();
 sexpSimpleString *newSimpleString();
 long int simpleStringLength();
 uint8_t *simpleStringString();
+void borrowSimpleString();
 sexpSimpleString *reallocateSimpleString();
 void appendCharToSimpleString();
+void appendBytesToSimpleString();
+sexpAtomTable *newSexpAtomTable();
+uint32_t hashAtomBytes();
+sexpSimpleString *internAtom();
+void freeSexpAtomTable();
 sexpString *newSexpString();
 sexpSimpleString *sexpStringPresentationHint();
 sexpSimpleString *sexpStringString();
@@ -94,6 +519,8 @@ void setSexpStringString();
 void closeSexpString();
 sexpList *newSexpList();
 void sexpAddSexpListObject();
+sexpList *sexpAppendSexpListObject();
+void invalidateHashCache();
 void closeSexpList();
 sexpIter *sexpListIter();
 sexpIter *sexpIterNext();
@@ -102,7 +529,11 @@ int isObjectString();
 int isObjectList();
 
 /* sexp-input */
+extern const uint8_t charClass[];
 void initializeCharacterTables();
+/* these take variable arguments, so need full prototypes */
+void sexpError(sexpInputStream *is, int code, const char *format, ...);
+void sexpWarning(sexpInputStream *is, const char *format, ...);
 int isWhiteSpace();
 int isDecDigit();
 int isHexDigit();
@@ -110,8 +541,16 @@ int isBase64Digit();
 int isTokenChar();
 int isAlpha();
 void changeInputByteSize();
+size_t fillInputBuffer();
+int nextInputByte();
 void getChar();
+long int copyInputBytes();
+void decodeInputRegion();
 sexpInputStream *newSexpInputStream();
+sexpInputStream *newSexpMemoryInputStream();
+void resetSexpMemoryInputStream();
+int openSexpInputFile();
+void freeSexpInputStream();
 void skipWhiteSpace();
 void skipChar();
 void scanToken();
@@ -121,25 +560,57 @@ void scanVerbatimString();
 void scanQuotedString();
 void scanHexString();
 void scanBase64String();
+sexpSimpleString *scanAtom();
 sexpSimpleString *scanSimpleString();
 sexpString *scanString();
-sexpList *scanList();
+void scanTransportRegion();
+void scanEvents();
+void treeAddObject();
+void treeOpenList();
+void treeCloseList();
+void treeString();
+sexpEventSink *newTreeBuilder();
+void tapeOpenList();
+void tapeCloseList();
+void tapeString();
+sexpEventSink *newTapeBuilder();
+sexpEventSink *tapeSink();
+sexpObject *scanTape();
+sexpObject *newLazyList();
+sexpList *scanLazyList();
 sexpObject *scanObject();
+sexpList *scanList();
+int sexpParseObject();
+long int findObjectEnd();
+long int measureList();
+int readObjects();
 
 /* sexp-output */
 void putChar();
+void putBytes();
 void varPutChar();
+void putEncodedChars();
+void varPutBytes();
 void changeOutputByteSize();
 void flushOutput();
 void newLine();
 sexpOutputStream *newSexpOutputStream();
+sexpOutputFrame *pushOutputFrame();
 void printDecimal();
 void canonicalPrintVerbatimSimpleString();
 void canonicalPrintString();
 void canonicalPrintList();
+void canonicalPrintTape();
 void canonicalPrintObject();
+void base64BeginWholeObject();
+void base64EndWholeObject();
 void base64PrintWholeObject();
+void canonicalOpenList();
+void canonicalCloseList();
+void canonicalString();
+sexpEventSink *newCanonicalSink();
 int canPrintAsToken();
+int isTokenSimpleString();
 int significantNibbles();
 void advancedPrintTokenSimpleString();
 int advancedLengthSimpleStringToken();
@@ -155,7 +626,75 @@ int advancedLengthSimpleStringBase64();
 int advancedLengthSimpleString();
 int advancedLengthString();
 int advancedLengthList();
+void advancedLayoutSimpleString();
+long int newListLayout();
+long int advancedLayoutList();
+void advancedLayoutObject();
+long int advancedLengthListUpTo();
+int advancedListIsTooLong();
+void advancedOpenList();
+void advancedPrintItems();
 void advancedPrintList();
 void advancedPrintObject();
 
+/* sexp-index */
+sexpIndex *newSexpIndex();
+uint8_t *findObjectKey();
+size_t writeIndexEntries();
+int readIndexEntry();
+int seekIndexRecord();
+
+/* sexp-hash */
+int hashAlgorithm();
+void initializeHash();
+void hashBytes();
+int digestLength();
+int finishHash();
+void hashPutChar();
+void hashPutBytes();
+void beginHash();
+int endHash();
+int sexpHashObject();
+sexpHashCache *sexpHashTree();
+uint8_t *sexpObjectDigest();
+void hashPrintObject();
+void printDigest();
+
+/* sexp-query */
+sexpList *sexpQuery();
+
+/* sexp-snapshot */
+sexpSnapshotWriter *newSexpSnapshotWriter();
+int writeSnapshotObject();
+void freeSexpSnapshotWriter();
+int writeSnapshot();
+sexpObject *scanSnapshotObject();
+
+/* sexp-stats */
+sexpStats *newSexpStats();
+int enterPhase();
+void beginObjectStats();
+void endObjectStats();
+void addSexpStats();
+void printSexpStats();
+void printSexpObjectStats();
+
+/* sexp-batch */
+sexpBatch *newSexpBatch();
+void *batchWorker();
+void batchPrintJob();
+void batchWriteJobs();
+void batchQueueJob();
+size_t batchQueueObjects();
+void batchProcess();
+
+/* sexp-codec */
+extern const uint8_t base64Values[];
+extern const uint8_t hexValues[];
+long int encodeBase64();
+long int encodeHex();
+long int decodeBase64();
+long int decodeHex();
+long int findStructural();
+
 #endif /* SEXP_H */